@@ -55,8 +55,8 @@ Result<i32, Err, MathErr> bar() {
 
     errdefer (stj::println("out!"));
     
-    stj::print("sum: %d\n", TRY(add(10, 12)));
-    stj::print("sum: %d\n", TRY(add(INT32_MAX , 12)));
+    stj::print(FMT("sum: {}\n"), TRY(add(10, 12)));
+    stj::print(FMT("sum: {}\n"), TRY(add(INT32_MAX , 12)));
 
     foo(list.items);
 
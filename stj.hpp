@@ -12,6 +12,46 @@
 #include <limits> 
 #include <algorithm>
 #include <utility>
+#include <memory>
+#include <functional>
+#include <tuple>
+#include <charconv>
+#include <cerrno>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#endif
+
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#endif
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#endif
+
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/epoll.h>) && __has_include(<sys/mman.h>)
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
 
 // TODO: clean the namespace
 namespace __stj_basic_impl {
@@ -19,20 +59,57 @@ namespace __stj_basic_impl {
 }
 
 // panic ===
-#define PANIC(msg) do { \
-    std::fprintf(stderr, "Panic at %s:%d: %s\n", __FILE__, __LINE__, msg); \
-    std::abort(); \
-} while(0)
+namespace stj {
+    struct PanicSite {
+        const char* msg;
+        const char* file;
+        int line;
+    };
+
+    // Called after the panic message is printed and before aborting, e.g. to
+    // flush logs or capture a stack trace. A panic inside the hook skips it.
+    using PanicHook = void (*)(const PanicSite& site);
+}
+
+namespace __stj_basic_impl {
+    inline std::atomic<stj::PanicHook> panic_hook{nullptr};
+
+    // Kept out of line and cold so check sites only pay for a single call.
+    [[noreturn, gnu::cold, gnu::noinline]] inline void panic(const stj::PanicSite* site) {
+        static thread_local bool panicking = false;
+        std::fprintf(stderr, "Panic at %s:%d: %s\n", site->file, site->line, site->msg);
+        stj::PanicHook hook = panic_hook.load(std::memory_order_acquire);
+        if (hook != nullptr && !panicking) {
+            panicking = true;
+            hook(*site);
+        }
+        std::abort();
+    }
+}
+
+namespace stj {
+    // Install a panic hook, returns the previously installed one.
+    inline PanicHook setPanicHook(PanicHook hook) {
+        return __stj_basic_impl::panic_hook.exchange(hook, std::memory_order_acq_rel);
+    }
+}
+
+#define PANIC(msg) ::__stj_basic_impl::panic([]() -> const ::stj::PanicSite* { \
+    static constexpr ::stj::PanicSite _stj_panic_site{msg, __FILE__, __LINE__}; \
+    return &_stj_panic_site; \
+}())
 // === panic
 
 // SafeInt ====
+template <typename T> class DeferredInt;
+
 template <typename T>
 class SafeInt {
 private:
     static_assert(std::is_integral_v<T>, "SafeInt can only wrap integral types");
     T value;
 
-    static bool add_overflow(T a, T b, T& result) {
+    static constexpr bool add_overflow(T a, T b, T& result) {
         if constexpr (std::is_unsigned_v<T>) {
             result = a + b;
             return result < a;
@@ -44,7 +121,7 @@ private:
         }
     }
 
-    static bool sub_overflow(T a, T b, T& result) {
+    static constexpr bool sub_overflow(T a, T b, T& result) {
         if constexpr (std::is_unsigned_v<T>) {
             result = a - b;
             return a < b;
@@ -56,7 +133,7 @@ private:
         }
     }
 
-    static bool mul_overflow(T a, T b, T& result) {
+    static constexpr bool mul_overflow(T a, T b, T& result) {
         if constexpr (std::is_unsigned_v<T>) {
             if (a == 0 || b == 0) {
                 result = 0;
@@ -86,52 +163,55 @@ private:
     }
 
 public:
-    SafeInt() : value(0) {}
-    SafeInt(T val) : value(val) {}
+    constexpr SafeInt() : value(0) {}
+    constexpr SafeInt(T val) : value(val) {}
 
     template <typename U, typename = std::enable_if_t<std::is_integral_v<U>>>
-    SafeInt(U val) : value(static_cast<T>(val)) {
+    constexpr SafeInt(U val) : value(static_cast<T>(val)) {
         if (static_cast<U>(static_cast<T>(val)) != val) {
             PANIC("Integer conversion overflow");
         }
     }
 
     template <typename U>
-    SafeInt(const SafeInt<U>& other) : value(static_cast<T>(other.raw())) {
+    constexpr SafeInt(const SafeInt<U>& other) : value(static_cast<T>(other.raw())) {
         if (static_cast<U>(static_cast<T>(other.raw())) != other.raw()) {
             PANIC("Integer conversion overflow");
         }
     }
 
-    operator T() const { return value; }
+    constexpr operator T() const { return value; }
+
+    constexpr T raw() const { return value; }
 
-    T raw() const { return value; }
+    // Start an expression whose overflow is checked once, see DeferredInt.
+    constexpr DeferredInt<T> deferred() const { return DeferredInt<T>(*this); }
 
-    SafeInt operator+(const SafeInt& other) const {
-        T result;
+    constexpr SafeInt operator+(const SafeInt& other) const {
+        T result = 0;
         if (add_overflow(value, other.value, result)) {
             PANIC("Integer overflow in addition");
         }
         return SafeInt(result);
     }
 
-    SafeInt operator-(const SafeInt& other) const {
-        T result;
+    constexpr SafeInt operator-(const SafeInt& other) const {
+        T result = 0;
         if (sub_overflow(value, other.value, result)) {
             PANIC("Integer underflow in subtraction");
         }
         return SafeInt(result);
     }
 
-    SafeInt operator*(const SafeInt& other) const {
-        T result;
+    constexpr SafeInt operator*(const SafeInt& other) const {
+        T result = 0;
         if (mul_overflow(value, other.value, result)) {
             PANIC("Integer overflow in multiplication");
         }
         return SafeInt(result);
     }
 
-    SafeInt operator/(const SafeInt& other) const {
+    constexpr SafeInt operator/(const SafeInt& other) const {
         if (other.value == 0) {
             PANIC("Division by zero");
         }
@@ -143,7 +223,7 @@ public:
         return SafeInt(value / other.value);
     }
 
-    SafeInt operator%(const SafeInt& other) const {
+    constexpr SafeInt operator%(const SafeInt& other) const {
         if (other.value == 0) {
             PANIC("Modulo by zero");
         }
@@ -156,36 +236,36 @@ public:
     }
 
     template <typename U>
-    auto operator+(const U& other) const -> SafeInt<decltype(value + U{})> {
+    constexpr auto operator+(const U& other) const -> SafeInt<decltype(value + U{})> {
         using ResultType = decltype(value + U{});
         return SafeInt<ResultType>(value) + SafeInt<ResultType>(other);
     }
 
     template <typename U>
-    auto operator-(const U& other) const -> SafeInt<decltype(value - U{})> {
+    constexpr auto operator-(const U& other) const -> SafeInt<decltype(value - U{})> {
         using ResultType = decltype(value - U{});
         return SafeInt<ResultType>(value) - SafeInt<ResultType>(other);
     }
 
     template <typename U>
-    auto operator*(const U& other) const -> SafeInt<decltype(value * U{})> {
+    constexpr auto operator*(const U& other) const -> SafeInt<decltype(value * U{})> {
         using ResultType = decltype(value * U{});
         return SafeInt<ResultType>(value) * SafeInt<ResultType>(other);
     }
 
     template <typename U>
-    auto operator/(const U& other) const -> SafeInt<decltype(value / U{})> {
+    constexpr auto operator/(const U& other) const -> SafeInt<decltype(value / U{})> {
         using ResultType = decltype(value / U{});
         return SafeInt<ResultType>(value) / SafeInt<ResultType>(other);
     }
 
     template <typename U>
-    auto operator%(const U& other) const -> SafeInt<decltype(value % U{})> {
+    constexpr auto operator%(const U& other) const -> SafeInt<decltype(value % U{})> {
         using ResultType = decltype(value % U{});
         return SafeInt<ResultType>(value) % SafeInt<ResultType>(other);
     }
 
-    SafeInt operator-() const {
+    constexpr SafeInt operator-() const {
         if constexpr (std::is_signed_v<T>) {
             if (value == std::numeric_limits<T>::min()) {
                 PANIC("Integer overflow in negation");
@@ -196,8 +276,8 @@ public:
         }
     }
 
-    SafeInt& operator+=(const SafeInt& other) {
-        T result;
+    constexpr SafeInt& operator+=(const SafeInt& other) {
+        T result = 0;
         if (add_overflow(value, other.value, result)) {
             PANIC("Integer overflow in addition");
         }
@@ -205,8 +285,8 @@ public:
         return *this;
     }
 
-    SafeInt& operator-=(const SafeInt& other) {
-        T result;
+    constexpr SafeInt& operator-=(const SafeInt& other) {
+        T result = 0;
         if (sub_overflow(value, other.value, result)) {
             PANIC("Integer underflow in subtraction");
         }
@@ -214,8 +294,8 @@ public:
         return *this;
     }
 
-    SafeInt& operator*=(const SafeInt& other) {
-        T result;
+    constexpr SafeInt& operator*=(const SafeInt& other) {
+        T result = 0;
         if (mul_overflow(value, other.value, result)) {
             PANIC("Integer overflow in multiplication");
         }
@@ -223,54 +303,54 @@ public:
         return *this;
     }
 
-    SafeInt& operator/=(const SafeInt& other) {
+    constexpr SafeInt& operator/=(const SafeInt& other) {
         *this = *this / other;
         return *this;
     }
 
-    SafeInt& operator%=(const SafeInt& other) {
+    constexpr SafeInt& operator%=(const SafeInt& other) {
         *this = *this % other;
         return *this;
     }
 
     template <typename U>
-    SafeInt& operator+=(const U& other) {
+    constexpr SafeInt& operator+=(const U& other) {
         *this = SafeInt(*this + other);
         return *this;
     }
 
     template <typename U>
-    SafeInt& operator-=(const U& other) {
+    constexpr SafeInt& operator-=(const U& other) {
         *this = SafeInt(*this - other);
         return *this;
     }
 
     template <typename U>
-    SafeInt& operator*=(const U& other) {
+    constexpr SafeInt& operator*=(const U& other) {
         *this = SafeInt(*this * other);
         return *this;
     }
 
     template <typename U>
-    SafeInt& operator/=(const U& other) {
+    constexpr SafeInt& operator/=(const U& other) {
         *this = SafeInt(*this / other);
         return *this;
     }
 
     template <typename U>
-    SafeInt& operator%=(const U& other) {
+    constexpr SafeInt& operator%=(const U& other) {
         *this = SafeInt(*this % other);
         return *this;
     }
 
     template <typename U>
-    SafeInt& operator=(const U& other) {
+    constexpr SafeInt& operator=(const U& other) {
         *this = SafeInt(other);
         return *this;
     }
 
-    SafeInt& operator++() {
-        T result;
+    constexpr SafeInt& operator++() {
+        T result = 0;
         if (add_overflow(value, T(1), result)) {
             PANIC("Integer overflow in increment");
         }
@@ -278,14 +358,14 @@ public:
         return *this;
     }
 
-    SafeInt operator++(int) {
+    constexpr SafeInt operator++(int) {
         SafeInt old = *this;
         ++(*this);
         return old;
     }
 
-    SafeInt& operator--() {
-        T result;
+    constexpr SafeInt& operator--() {
+        T result = 0;
         if (sub_overflow(value, T(1), result)) {
             PANIC("Integer underflow in decrement");
         }
@@ -293,43 +373,43 @@ public:
         return *this;
     }
 
-    SafeInt operator--(int) {
+    constexpr SafeInt operator--(int) {
         SafeInt old = *this;
         --(*this);
         return old;
     }
 
-    bool operator==(const SafeInt& other) const { return value == other.value; }
-    bool operator!=(const SafeInt& other) const { return value != other.value; }
-    bool operator<(const SafeInt& other) const { return value < other.value; }
-    bool operator<=(const SafeInt& other) const { return value <= other.value; }
-    bool operator>(const SafeInt& other) const { return value > other.value; }
-    bool operator>=(const SafeInt& other) const { return value >= other.value; }
+    constexpr bool operator==(const SafeInt& other) const { return value == other.value; }
+    constexpr bool operator!=(const SafeInt& other) const { return value != other.value; }
+    constexpr bool operator<(const SafeInt& other) const { return value < other.value; }
+    constexpr bool operator<=(const SafeInt& other) const { return value <= other.value; }
+    constexpr bool operator>(const SafeInt& other) const { return value > other.value; }
+    constexpr bool operator>=(const SafeInt& other) const { return value >= other.value; }
 
     template <typename U>
-    bool operator==(const U& other) const { return value == other; }
+    constexpr bool operator==(const U& other) const { return value == other; }
     
     template <typename U>
-    bool operator!=(const U& other) const { return value != other; }
+    constexpr bool operator!=(const U& other) const { return value != other; }
     
     template <typename U>
-    bool operator<(const U& other) const { return value < other; }
+    constexpr bool operator<(const U& other) const { return value < other; }
     
     template <typename U>
-    bool operator<=(const U& other) const { return value <= other; }
+    constexpr bool operator<=(const U& other) const { return value <= other; }
     
     template <typename U>
-    bool operator>(const U& other) const { return value > other; }
+    constexpr bool operator>(const U& other) const { return value > other; }
     
     template <typename U>
-    bool operator>=(const U& other) const { return value >= other; }
+    constexpr bool operator>=(const U& other) const { return value >= other; }
 
-    SafeInt operator&(const SafeInt& other) const { return SafeInt(value & other.value); }
-    SafeInt operator|(const SafeInt& other) const { return SafeInt(value | other.value); }
-    SafeInt operator^(const SafeInt& other) const { return SafeInt(value ^ other.value); }
-    SafeInt operator~() const { return SafeInt(~value); }
+    constexpr SafeInt operator&(const SafeInt& other) const { return SafeInt(value & other.value); }
+    constexpr SafeInt operator|(const SafeInt& other) const { return SafeInt(value | other.value); }
+    constexpr SafeInt operator^(const SafeInt& other) const { return SafeInt(value ^ other.value); }
+    constexpr SafeInt operator~() const { return SafeInt(~value); }
     
-    SafeInt operator<<(const SafeInt& shift) const {
+    constexpr SafeInt operator<<(const SafeInt& shift) const {
         if (shift.value < 0 || shift.value >= static_cast<T>(sizeof(T) * 8)) {
             PANIC("Invalid shift amount");
         }
@@ -351,7 +431,7 @@ public:
         return SafeInt(value << shift.value);
     }
     
-    SafeInt operator>>(const SafeInt& shift) const {
+    constexpr SafeInt operator>>(const SafeInt& shift) const {
         if (shift.value < 0 || shift.value >= static_cast<T>(sizeof(T) * 8)) {
             PANIC("Invalid shift amount");
         }
@@ -375,6 +455,294 @@ using usize = SafeInt<std::size_t>;
 using isize = SafeInt<std::ptrdiff_t>;
 // ==== SafeInt
 
+// DeferredInt ====
+// Evaluates a compound SafeInt<T> expression while accumulating overflow into
+// a flag instead of branching at every operation. The flag is checked once
+// when the result is converted back to SafeInt<T>, and it is set exactly when
+// one of the per-operation checks would have panicked. Every sub-expression
+// that mixes only SafeInts is still checked eagerly, so start each one:
+//     i64 r = a.deferred() * b + c.deferred() * d - e;
+template <typename T>
+class DeferredInt {
+private:
+    T value;
+    bool overflow;
+
+    constexpr DeferredInt(T val, bool overflowed) : value(val), overflow(overflowed) {}
+
+public:
+    constexpr explicit DeferredInt(const SafeInt<T>& val) : value(val.raw()), overflow(false) {}
+
+    constexpr bool overflowed() const { return overflow; }
+
+    constexpr operator SafeInt<T>() const {
+        if (overflow) [[unlikely]] {
+            PANIC("Integer overflow in deferred expression");
+        }
+        return SafeInt<T>(value);
+    }
+
+    friend constexpr DeferredInt operator+(const DeferredInt& a, const DeferredInt& b) {
+        T result = 0;
+        bool o = __builtin_add_overflow(a.value, b.value, &result);
+        return DeferredInt(result, a.overflow | b.overflow | o);
+    }
+
+    friend constexpr DeferredInt operator-(const DeferredInt& a, const DeferredInt& b) {
+        T result = 0;
+        bool o = __builtin_sub_overflow(a.value, b.value, &result);
+        return DeferredInt(result, a.overflow | b.overflow | o);
+    }
+
+    friend constexpr DeferredInt operator*(const DeferredInt& a, const DeferredInt& b) {
+        T result = 0;
+        bool o = __builtin_mul_overflow(a.value, b.value, &result);
+        return DeferredInt(result, a.overflow | b.overflow | o);
+    }
+
+    // Division by zero is reported like an overflow, the quotient is then meaningless.
+    friend constexpr DeferredInt operator/(const DeferredInt& a, const DeferredInt& b) {
+        bool o = b.value == 0;
+        if constexpr (std::is_signed_v<T>) {
+            o |= a.value == std::numeric_limits<T>::min() && b.value == -1;
+        }
+        T divisor = o ? T(1) : b.value;
+        return DeferredInt(static_cast<T>(a.value / divisor), a.overflow | b.overflow | o);
+    }
+
+    friend constexpr DeferredInt operator%(const DeferredInt& a, const DeferredInt& b) {
+        bool o = b.value == 0;
+        T divisor = o ? T(1) : b.value;
+        if constexpr (std::is_signed_v<T>) {
+            if (b.value == -1) divisor = 1;
+        }
+        return DeferredInt(static_cast<T>(a.value % divisor), a.overflow | b.overflow | o);
+    }
+
+    constexpr DeferredInt operator-() const {
+        if constexpr (std::is_signed_v<T>) {
+            bool o = value == std::numeric_limits<T>::min();
+            return DeferredInt(o ? value : static_cast<T>(-value), overflow | o);
+        } else {
+            return DeferredInt(value, true);
+        }
+    }
+
+    friend constexpr DeferredInt operator+(const DeferredInt& a, const SafeInt<T>& b) { return a + DeferredInt(b); }
+    friend constexpr DeferredInt operator-(const DeferredInt& a, const SafeInt<T>& b) { return a - DeferredInt(b); }
+    friend constexpr DeferredInt operator*(const DeferredInt& a, const SafeInt<T>& b) { return a * DeferredInt(b); }
+    friend constexpr DeferredInt operator/(const DeferredInt& a, const SafeInt<T>& b) { return a / DeferredInt(b); }
+    friend constexpr DeferredInt operator%(const DeferredInt& a, const SafeInt<T>& b) { return a % DeferredInt(b); }
+
+    friend constexpr DeferredInt operator+(const SafeInt<T>& a, const DeferredInt& b) { return DeferredInt(a) + b; }
+    friend constexpr DeferredInt operator-(const SafeInt<T>& a, const DeferredInt& b) { return DeferredInt(a) - b; }
+    friend constexpr DeferredInt operator*(const SafeInt<T>& a, const DeferredInt& b) { return DeferredInt(a) * b; }
+    friend constexpr DeferredInt operator/(const SafeInt<T>& a, const DeferredInt& b) { return DeferredInt(a) / b; }
+    friend constexpr DeferredInt operator%(const SafeInt<T>& a, const DeferredInt& b) { return DeferredInt(a) % b; }
+};
+// ==== DeferredInt
+
+// WrapInt ====
+// Integer with two's complement wrapping arithmetic. Converts to and from
+// SafeInt only explicitly so wrapping never leaks into checked code silently.
+template <typename T>
+class WrapInt {
+private:
+    static_assert(std::is_integral_v<T>, "WrapInt can only wrap integral types");
+    using Bits = std::make_unsigned_t<T>;
+    T value;
+
+public:
+    constexpr WrapInt() : value(0) {}
+    constexpr WrapInt(T val) : value(val) {}
+    constexpr explicit WrapInt(const SafeInt<T>& val) : value(val.raw()) {}
+
+    constexpr explicit operator SafeInt<T>() const { return SafeInt<T>(value); }
+
+    constexpr T raw() const { return value; }
+
+    constexpr WrapInt operator+(const WrapInt& other) const {
+        T result = 0;
+        __builtin_add_overflow(value, other.value, &result);
+        return WrapInt(result);
+    }
+
+    constexpr WrapInt operator-(const WrapInt& other) const {
+        T result = 0;
+        __builtin_sub_overflow(value, other.value, &result);
+        return WrapInt(result);
+    }
+
+    constexpr WrapInt operator*(const WrapInt& other) const {
+        T result = 0;
+        __builtin_mul_overflow(value, other.value, &result);
+        return WrapInt(result);
+    }
+
+    constexpr WrapInt operator/(const WrapInt& other) const {
+        if (other.value == 0) {
+            PANIC("Division by zero");
+        }
+        if constexpr (std::is_signed_v<T>) {
+            if (value == std::numeric_limits<T>::min() && other.value == -1) {
+                return *this;
+            }
+        }
+        return WrapInt(static_cast<T>(value / other.value));
+    }
+
+    constexpr WrapInt operator%(const WrapInt& other) const {
+        if (other.value == 0) {
+            PANIC("Modulo by zero");
+        }
+        if constexpr (std::is_signed_v<T>) {
+            if (value == std::numeric_limits<T>::min() && other.value == -1) {
+                return WrapInt(0);
+            }
+        }
+        return WrapInt(static_cast<T>(value % other.value));
+    }
+
+    constexpr WrapInt operator-() const {
+        return WrapInt(0) - *this;
+    }
+
+    constexpr WrapInt& operator+=(const WrapInt& other) { return *this = *this + other; }
+    constexpr WrapInt& operator-=(const WrapInt& other) { return *this = *this - other; }
+    constexpr WrapInt& operator*=(const WrapInt& other) { return *this = *this * other; }
+    constexpr WrapInt& operator/=(const WrapInt& other) { return *this = *this / other; }
+    constexpr WrapInt& operator%=(const WrapInt& other) { return *this = *this % other; }
+
+    constexpr WrapInt& operator++() { return *this += WrapInt(1); }
+    constexpr WrapInt& operator--() { return *this -= WrapInt(1); }
+    constexpr WrapInt operator++(int) { WrapInt old = *this; ++(*this); return old; }
+    constexpr WrapInt operator--(int) { WrapInt old = *this; --(*this); return old; }
+
+    constexpr bool operator==(const WrapInt& other) const { return value == other.value; }
+    constexpr bool operator!=(const WrapInt& other) const { return value != other.value; }
+    constexpr bool operator<(const WrapInt& other) const { return value < other.value; }
+    constexpr bool operator<=(const WrapInt& other) const { return value <= other.value; }
+    constexpr bool operator>(const WrapInt& other) const { return value > other.value; }
+    constexpr bool operator>=(const WrapInt& other) const { return value >= other.value; }
+
+    constexpr WrapInt operator&(const WrapInt& other) const { return WrapInt(static_cast<T>(value & other.value)); }
+    constexpr WrapInt operator|(const WrapInt& other) const { return WrapInt(static_cast<T>(value | other.value)); }
+    constexpr WrapInt operator^(const WrapInt& other) const { return WrapInt(static_cast<T>(value ^ other.value)); }
+    constexpr WrapInt operator~() const { return WrapInt(static_cast<T>(~value)); }
+
+    // Bits shifted out are discarded, the shift amount itself is still checked.
+    constexpr WrapInt operator<<(unsigned shift) const {
+        if (shift >= sizeof(T) * 8) {
+            PANIC("Invalid shift amount");
+        }
+        return WrapInt(static_cast<T>(static_cast<Bits>(static_cast<Bits>(value) << shift)));
+    }
+
+    constexpr WrapInt operator>>(unsigned shift) const {
+        if (shift >= sizeof(T) * 8) {
+            PANIC("Invalid shift amount");
+        }
+        return WrapInt(static_cast<T>(value >> shift));
+    }
+};
+// ==== WrapInt
+
+// SatInt ====
+// Integer whose arithmetic clamps to the bounds of T instead of overflowing.
+template <typename T>
+class SatInt {
+private:
+    static_assert(std::is_integral_v<T>, "SatInt can only wrap integral types");
+    T value;
+
+    static constexpr T max = std::numeric_limits<T>::max();
+    static constexpr T min = std::numeric_limits<T>::min();
+
+public:
+    constexpr SatInt() : value(0) {}
+    constexpr SatInt(T val) : value(val) {}
+    constexpr explicit SatInt(const SafeInt<T>& val) : value(val.raw()) {}
+
+    constexpr explicit operator SafeInt<T>() const { return SafeInt<T>(value); }
+
+    constexpr T raw() const { return value; }
+
+    constexpr SatInt operator+(const SatInt& other) const {
+        T result = 0;
+        if (__builtin_add_overflow(value, other.value, &result)) {
+            return SatInt(other.value > 0 ? max : min);
+        }
+        return SatInt(result);
+    }
+
+    constexpr SatInt operator-(const SatInt& other) const {
+        T result = 0;
+        if (__builtin_sub_overflow(value, other.value, &result)) {
+            if constexpr (std::is_unsigned_v<T>) {
+                return SatInt(min);
+            } else {
+                return SatInt(other.value < 0 ? max : min);
+            }
+        }
+        return SatInt(result);
+    }
+
+    constexpr SatInt operator*(const SatInt& other) const {
+        T result = 0;
+        if (__builtin_mul_overflow(value, other.value, &result)) {
+            return SatInt((value < 0) != (other.value < 0) ? min : max);
+        }
+        return SatInt(result);
+    }
+
+    constexpr SatInt operator/(const SatInt& other) const {
+        if (other.value == 0) {
+            PANIC("Division by zero");
+        }
+        if constexpr (std::is_signed_v<T>) {
+            if (value == min && other.value == -1) {
+                return SatInt(max);
+            }
+        }
+        return SatInt(static_cast<T>(value / other.value));
+    }
+
+    constexpr SatInt operator%(const SatInt& other) const {
+        if (other.value == 0) {
+            PANIC("Modulo by zero");
+        }
+        if constexpr (std::is_signed_v<T>) {
+            if (value == min && other.value == -1) {
+                return SatInt(0);
+            }
+        }
+        return SatInt(static_cast<T>(value % other.value));
+    }
+
+    constexpr SatInt operator-() const {
+        return SatInt(0) - *this;
+    }
+
+    constexpr SatInt& operator+=(const SatInt& other) { return *this = *this + other; }
+    constexpr SatInt& operator-=(const SatInt& other) { return *this = *this - other; }
+    constexpr SatInt& operator*=(const SatInt& other) { return *this = *this * other; }
+    constexpr SatInt& operator/=(const SatInt& other) { return *this = *this / other; }
+    constexpr SatInt& operator%=(const SatInt& other) { return *this = *this % other; }
+
+    constexpr SatInt& operator++() { return *this += SatInt(1); }
+    constexpr SatInt& operator--() { return *this -= SatInt(1); }
+    constexpr SatInt operator++(int) { SatInt old = *this; ++(*this); return old; }
+    constexpr SatInt operator--(int) { SatInt old = *this; --(*this); return old; }
+
+    constexpr bool operator==(const SatInt& other) const { return value == other.value; }
+    constexpr bool operator!=(const SatInt& other) const { return value != other.value; }
+    constexpr bool operator<(const SatInt& other) const { return value < other.value; }
+    constexpr bool operator<=(const SatInt& other) const { return value <= other.value; }
+    constexpr bool operator>(const SatInt& other) const { return value > other.value; }
+    constexpr bool operator>=(const SatInt& other) const { return value >= other.value; }
+};
+// ==== SatInt
+
 // defer ====
 template <typename F>
 struct privDefer {
@@ -395,6 +763,34 @@ privDefer<F> defer_func(F f) {
 // ==== defer
 
 // Error ====
+namespace __stj_basic_impl {
+    using TagType = std::uint8_t;
+    constexpr TagType INVALID_TAG = 0;
+    constexpr TagType VALUE_TAG = 1;
+
+    // Errors are stored as the bits of their underlying value so that Error
+    // and Result stay usable in constant expressions.
+    template <std::size_t Size> struct error_bits;
+    template <> struct error_bits<1> { using type = std::uint8_t; };
+    template <> struct error_bits<2> { using type = std::uint16_t; };
+    template <> struct error_bits<4> { using type = std::uint32_t; };
+    template <> struct error_bits<8> { using type = std::uint64_t; };
+
+    template <typename... Enums>
+    using ErrorBits = typename error_bits<std::max({sizeof(Enums)...})>::type;
+
+    template <typename Bits, typename E>
+    constexpr Bits toErrorBits(E error) {
+        static_assert(std::is_enum_v<E>, "errors must be enum types");
+        return static_cast<Bits>(error);
+    }
+
+    template <typename E, typename Bits>
+    constexpr E fromErrorBits(Bits bits) {
+        return static_cast<E>(static_cast<std::underlying_type_t<E>>(bits));
+    }
+}
+
 template <typename... Enums>
 class Error {
 private:
@@ -416,14 +812,12 @@ private:
         static constexpr std::size_t value = 0;
     };
 
-    using TagType = std::uint8_t;
-    static constexpr TagType INVALID_TAG = 0;
-    static constexpr TagType VALUE_TAG = 1;
-    
-    union Storage {
-        char errorStorage[std::max({sizeof(Enums)...})];
-    } storage;
+    using TagType = __stj_basic_impl::TagType;
+    using Bits = __stj_basic_impl::ErrorBits<Enums...>;
+    static constexpr TagType INVALID_TAG = __stj_basic_impl::INVALID_TAG;
+    static constexpr TagType VALUE_TAG = __stj_basic_impl::VALUE_TAG;
     
+    Bits bits;
     TagType tag;
     
     template <typename E>
@@ -436,24 +830,21 @@ private:
     }
 
     template <typename E, typename... Os>
-    void tryConvertEnum(const Error<Os...>& other, bool& converted) {
+    constexpr void tryConvertEnum(const Error<Os...>& other, bool& converted) {
         if (!converted && other.template is<E>()) {
-            E error = other.template get<E>();
             tag = getTagForType<E>();
-            *reinterpret_cast<E*>(storage.errorStorage) = error;
+            bits = __stj_basic_impl::toErrorBits<Bits>(other.template get<E>());
             converted = true;
         }
     }
 public:
-    Error() : tag(INVALID_TAG) {}
+    constexpr Error() : bits(0), tag(INVALID_TAG) {}
     
     template <typename E, typename = std::enable_if_t<contains_type<E, Enums...>::value>>
-    Error(E error) : tag(getTagForType<E>()) {
-        *reinterpret_cast<E*>(storage.errorStorage) = error;
-    }
+    constexpr Error(E error) : bits(__stj_basic_impl::toErrorBits<Bits>(error)), tag(getTagForType<E>()) {}
     
     template <typename... OtherEnums>
-    Error(const Error<OtherEnums...>& other) : tag(INVALID_TAG) {
+    constexpr Error(const Error<OtherEnums...>& other) : bits(0), tag(INVALID_TAG) {
         static_assert(
             (contains_type<OtherEnums, Enums...>::value && ...), 
             "Target Error type must include all enum types from source Error"
@@ -468,31 +859,160 @@ public:
     }
 
     template <typename E, typename = std::enable_if_t<contains_type<E, Enums...>::value>>
-    bool is() const {
+    constexpr bool is() const {
         return tag == getTagForType<E>();
     }
     
-    bool hasError() const {
+    constexpr bool hasError() const {
         return tag != INVALID_TAG;
     }
     
     template <typename E, typename = std::enable_if_t<contains_type<E, Enums...>::value>>
-    E get() const {
+    constexpr E get() const {
         if (tag != getTagForType<E>()) {
             PANIC("Error does not contain this error type");
         }
-        return *reinterpret_cast<const E*>(storage.errorStorage);
+        return __stj_basic_impl::fromErrorBits<E>(bits);
     }
     
-    bool isEmpty() const {
+    constexpr bool isEmpty() const {
         return tag == INVALID_TAG;
     }
+
+    // With these TRY and CO_TRY take an Error like a Result without a value.
+    constexpr bool hasAnyError() const {
+        return tag != INVALID_TAG;
+    }
+
+    constexpr void value() const {}
 };
 // ==== Error
 
 // Result ====
+namespace __stj_basic_impl {
+    struct ValueTag {};
+    struct ErrorTag {};
+
+    template <typename T, typename Bits, bool = std::is_trivially_destructible_v<T>>
+    union ResultUnion {
+        char empty;
+        T value;
+        Bits error;
+
+        constexpr ResultUnion() : empty() {}
+        template <typename... Args>
+        constexpr ResultUnion(ValueTag, Args&&... args) : value(std::forward<Args>(args)...) {}
+        constexpr ResultUnion(ErrorTag, Bits bits) : error(bits) {}
+    };
+
+    template <typename T, typename Bits>
+    union ResultUnion<T, Bits, false> {
+        char empty;
+        T value;
+        Bits error;
+
+        constexpr ResultUnion() : empty() {}
+        template <typename... Args>
+        constexpr ResultUnion(ValueTag, Args&&... args) : value(std::forward<Args>(args)...) {}
+        constexpr ResultUnion(ErrorTag, Bits bits) : error(bits) {}
+        ~ResultUnion() {}
+    };
+
+    // Trivially destructible payloads keep Result trivially destructible, which
+    // is what makes it a literal type.
+    template <typename T, typename Bits, bool = std::is_trivially_destructible_v<T>>
+    struct ResultStorage {
+        ResultUnion<T, Bits> storage;
+        TagType tag;
+
+        constexpr ResultStorage() : storage(), tag(INVALID_TAG) {}
+        template <typename... Args>
+        constexpr ResultStorage(ValueTag, Args&&... args) : storage(ValueTag{}, std::forward<Args>(args)...), tag(VALUE_TAG) {}
+        constexpr ResultStorage(ErrorTag, Bits bits, TagType error_tag) : storage(ErrorTag{}, bits), tag(error_tag) {}
+
+        void cleanup() {}
+    };
+
+    template <typename T, typename Bits>
+    struct ResultStorage<T, Bits, false> {
+        ResultUnion<T, Bits> storage;
+        TagType tag;
+
+        constexpr ResultStorage() : storage(), tag(INVALID_TAG) {}
+        template <typename... Args>
+        constexpr ResultStorage(ValueTag, Args&&... args) : storage(ValueTag{}, std::forward<Args>(args)...), tag(VALUE_TAG) {}
+        constexpr ResultStorage(ErrorTag, Bits bits, TagType error_tag) : storage(ErrorTag{}, bits), tag(error_tag) {}
+
+        ~ResultStorage() {
+            cleanup();
+        }
+
+        void cleanup() {
+            if (tag == VALUE_TAG) {
+                storage.value.~T();
+            }
+        }
+    };
+
+    // Trivially copyable payloads get the defaulted (and constexpr) copies.
+    template <typename T, typename Bits, bool = std::is_trivially_copyable_v<T>>
+    struct ResultCopy : ResultStorage<T, Bits> {
+        using ResultStorage<T, Bits>::ResultStorage;
+    };
+
+    template <typename T, typename Bits>
+    struct ResultCopy<T, Bits, false> : ResultStorage<T, Bits> {
+        using Base = ResultStorage<T, Bits>;
+        using Base::Base;
+
+        ResultCopy(const ResultCopy& other) : Base() {
+            copyFrom(other);
+        }
+
+        ResultCopy(ResultCopy&& other) noexcept : Base() {
+            moveFrom(std::move(other));
+        }
+
+        ResultCopy& operator=(const ResultCopy& other) {
+            if (this != &other) {
+                this->cleanup();
+                copyFrom(other);
+            }
+            return *this;
+        }
+
+        ResultCopy& operator=(ResultCopy&& other) noexcept {
+            if (this != &other) {
+                this->cleanup();
+                moveFrom(std::move(other));
+            }
+            return *this;
+        }
+
+        void copyFrom(const ResultCopy& other) {
+            this->tag = other.tag;
+            if (this->tag == VALUE_TAG) {
+                new (&this->storage.value) T(other.storage.value);
+            } else if (this->tag > VALUE_TAG) {
+                this->storage.error = other.storage.error;
+            }
+        }
+
+        void moveFrom(ResultCopy&& other) {
+            this->tag = other.tag;
+            if (this->tag == VALUE_TAG) {
+                new (&this->storage.value) T(std::move(other.storage.value));
+            } else if (this->tag > VALUE_TAG) {
+                this->storage.error = other.storage.error;
+            }
+            other.cleanup();
+            other.tag = INVALID_TAG;
+        }
+    };
+}
+
 template <typename T, typename... Enums>
-class Result {
+class Result : private __stj_basic_impl::ResultCopy<T, __stj_basic_impl::ErrorBits<Enums...>> {
 private:
     template <typename D, typename... Ts>
     struct contains_type {
@@ -512,19 +1032,13 @@ private:
         static constexpr std::size_t value = 0;
     };
 
-    using TagType = std::uint8_t;
-    static constexpr TagType INVALID_TAG = 0;
-    static constexpr TagType VALUE_TAG = 1;
-    
-    union Storage {
-        alignas(T) char valueStorage[sizeof(T)];
-        char errorStorage[std::max({sizeof(Enums)...})];
-        
-        Storage() {}
-        ~Storage() {}
-    } storage;
-    
-    TagType tag;
+    using TagType = __stj_basic_impl::TagType;
+    using Bits = __stj_basic_impl::ErrorBits<Enums...>;
+    using Base = __stj_basic_impl::ResultCopy<T, Bits>;
+    using ValueTag = __stj_basic_impl::ValueTag;
+    using ErrorTag = __stj_basic_impl::ErrorTag;
+    static constexpr TagType INVALID_TAG = __stj_basic_impl::INVALID_TAG;
+    static constexpr TagType VALUE_TAG = __stj_basic_impl::VALUE_TAG;
     
     template <typename E>
     static constexpr TagType getTagForType() {
@@ -535,166 +1049,220 @@ private:
         return static_cast<TagType>(index_of<E, Enums...>::value + 2);
     }
 
-    template <typename E, typename U, typename... Os>
-    void tryConvertEnum(const Result<U, Os...>& other, bool& converted) {
-        if (!converted && other.template hasError<E>()) {
-            E error = other.template error<E>();
-            tag = getTagForType<E>();
-            *reinterpret_cast<E*>(storage.errorStorage) = error;
-            converted = true;
-        }
-    }
+    template <typename... Args>
+    constexpr Result(ValueTag, Args&&... args) : Base(ValueTag{}, std::forward<Args>(args)...) {}
+
+    constexpr Result(ErrorTag, Bits bits, TagType error_tag) : Base(ErrorTag{}, bits, error_tag) {}
+
+    template <typename U, typename... OtherEnums>
+    static constexpr Result convertFrom(const Result<U, OtherEnums...>& other) {
+        static_assert(
+            (contains_type<OtherEnums, Enums...>::value && ...), 
+            "Target Result type must include all enum types from source Result"
+        );
 
-    void cleanup() {
-        if (tag == VALUE_TAG) {
-            reinterpret_cast<T*>(storage.valueStorage)->~T();
+        if (other.hasValue()) {
+            return Result(ValueTag{}, other.value());
         }
-    }
 
-    void copyFrom(const Result& other) {
-        tag = other.tag;
-        if (tag == VALUE_TAG) {
-            new (storage.valueStorage) T(other.value());
-        } else if (tag > VALUE_TAG) {
-            std::memcpy(storage.errorStorage, other.storage.errorStorage, sizeof(storage.errorStorage));
+        TagType error_tag = INVALID_TAG;
+        Bits bits = 0;
+        ((other.template hasError<OtherEnums>()
+            ? (error_tag = getTagForType<OtherEnums>(), bits = __stj_basic_impl::toErrorBits<Bits>(other.template error<OtherEnums>()))
+            : bits), ...);
+
+        if (error_tag == INVALID_TAG) {
+            return Result();
         }
+        return Result(ErrorTag{}, bits, error_tag);
     }
 
-    void moveFrom(Result&& other) {
-        tag = other.tag;
-        if (tag == VALUE_TAG) {
-            new (storage.valueStorage) T(std::move(other.value()));
-        } else if (tag > VALUE_TAG) {
-            std::memcpy(storage.errorStorage, other.storage.errorStorage, sizeof(storage.errorStorage));
+    template <typename... OtherEnums>
+    static constexpr Result convertFrom(const Error<OtherEnums...>& other) {
+        static_assert(
+            (contains_type<OtherEnums, Enums...>::value && ...), 
+            "Target Result type must include all enum types from source Error"
+        );
+
+        TagType error_tag = INVALID_TAG;
+        Bits bits = 0;
+        ((other.template is<OtherEnums>()
+            ? (error_tag = getTagForType<OtherEnums>(), bits = __stj_basic_impl::toErrorBits<Bits>(other.template get<OtherEnums>()))
+            : bits), ...);
+
+        if (error_tag == INVALID_TAG) {
+            return Result();
         }
-        other.tag = INVALID_TAG;
+        return Result(ErrorTag{}, bits, error_tag);
     }
 
 public:
-    Result() : tag(INVALID_TAG) {}
+    constexpr Result() : Base() {}
     
-    Result(const T& value) : tag(VALUE_TAG) {
-        new (storage.valueStorage) T(value);
-    }
+    constexpr Result(const T& value) : Base(ValueTag{}, value) {}
     
-    Result(T&& value) : tag(VALUE_TAG) {
-        new (storage.valueStorage) T(std::move(value));
-    }
+    constexpr Result(T&& value) : Base(ValueTag{}, std::move(value)) {}
     
     template <typename U, typename = std::enable_if_t<
         std::is_convertible_v<U, T> && 
         !std::is_same_v<std::decay_t<U>, T> &&
         !contains_type<std::decay_t<U>, Enums...>::value
     >>
-    Result(U&& value) : tag(VALUE_TAG) {
-        new (storage.valueStorage) T(std::forward<U>(value));
-    }
+    constexpr Result(U&& value) : Base(ValueTag{}, std::forward<U>(value)) {}
     
     template <typename E, typename = std::enable_if_t<contains_type<E, Enums...>::value>>
-    Result(E error) : tag(getTagForType<E>()) {
-        *reinterpret_cast<E*>(storage.errorStorage) = error;
-    }
+    constexpr Result(E error) : Base(ErrorTag{}, __stj_basic_impl::toErrorBits<Bits>(error), getTagForType<E>()) {}
 
     template <typename U, typename... OtherEnums, typename = std::enable_if_t<std::is_convertible_v<U, T>>>
-    Result(const Result<U, OtherEnums...>& other) : tag(INVALID_TAG) {
-        static_assert(
-            (contains_type<OtherEnums, Enums...>::value && ...), 
-            "Target Result type must include all enum types from source Result"
-        );
-        
-        if (other.isEmpty()) {
-            return;
-        }
-        
-        if (other.hasValue()) {
-            tag = VALUE_TAG;
-            new (storage.valueStorage) T(other.value());
-            return;
-        }
-        
-        bool converted = false;
-        (tryConvertEnum<OtherEnums>(other, converted), ...);
+    constexpr Result(const Result<U, OtherEnums...>& other) : Result(convertFrom(other)) {}
+
+    // Takes over the error, an empty Error gives an empty Result.
+    template <typename... OtherEnums>
+    constexpr Result(const Error<OtherEnums...>& other) : Result(convertFrom(other)) {}
+    
+    constexpr bool hasValue() const {
+        return this->tag == VALUE_TAG;
     }
     
-    Result(const Result& other) : tag(INVALID_TAG) {
-        copyFrom(other);
+    template <typename E, typename = std::enable_if_t<contains_type<E, Enums...>::value>>
+    constexpr bool hasError() const {
+        return this->tag == getTagForType<E>();
     }
     
-    Result(Result&& other) noexcept : tag(INVALID_TAG) {
-        moveFrom(std::move(other));
+    constexpr bool hasAnyError() const {
+        return this->tag > VALUE_TAG;
     }
     
-    Result& operator=(const Result& other) {
-        if (this != &other) {
-            cleanup();
-            copyFrom(other);
-        }
-        return *this;
-    }
-    
-    Result& operator=(Result&& other) noexcept {
-        if (this != &other) {
-            cleanup();
-            moveFrom(std::move(other));
-        }
-        return *this;
-    }
-    
-    ~Result() {
-        cleanup();
-    }
-    
-    bool hasValue() const {
-        return tag == VALUE_TAG;
-    }
-    
-    template <typename E, typename = std::enable_if_t<contains_type<E, Enums...>::value>>
-    bool hasError() const {
-        return tag == getTagForType<E>();
-    }
-    
-    bool hasAnyError() const {
-        return tag > VALUE_TAG;
-    }
-    
-    T& value() {
-        if (tag != VALUE_TAG) {
+    constexpr T& value() {
+        if (this->tag != VALUE_TAG) {
             PANIC("Result does not contain a value");
         }
-        return *reinterpret_cast<T*>(storage.valueStorage);
+        return this->storage.value;
     }
     
-    const T& value() const {
-        if (tag != VALUE_TAG) {
+    constexpr const T& value() const {
+        if (this->tag != VALUE_TAG) {
             PANIC("Result does not contain a value");
         }
-        return *reinterpret_cast<const T*>(storage.valueStorage);
+        return this->storage.value;
     }
     
     template <typename E, typename = std::enable_if_t<contains_type<E, Enums...>::value>>
-    E error() const {
-        if (tag != getTagForType<E>()) {
+    constexpr E error() const {
+        if (this->tag != getTagForType<E>()) {
             PANIC("Result does not contain this error type");
         }
-        return *reinterpret_cast<const E*>(storage.errorStorage);
+        return __stj_basic_impl::fromErrorBits<E>(this->storage.error);
     }
     
-    T valueOr(const T& defaultValue) const {
+    constexpr T valueOr(const T& defaultValue) const {
         return hasValue() ? value() : defaultValue;
     }
     
-    bool isEmpty() const {
-        return tag == INVALID_TAG;
+    constexpr bool isEmpty() const {
+        return this->tag == INVALID_TAG;
     }
 };
 // ==== Result
 
+// error return trace ====
+// Opt-in with `#define STJ_ERROR_RETURN_TRACE` before including stj.hpp.
+// Every TRY that propagates an error records its site and return address in
+// a fixed-size per-thread ring buffer; when disabled, TRY records nothing.
+#ifndef STJ_ERROR_RETURN_TRACE_LEN
+#define STJ_ERROR_RETURN_TRACE_LEN 32
+#endif
+
+namespace stj {
+    namespace debug {
+        struct ErrorReturnSite {
+            const char* file;
+            int line;
+            const char* function;
+        };
+    }
+}
+
+#ifdef STJ_ERROR_RETURN_TRACE
+namespace __stj_basic_impl {
+    static_assert(
+        STJ_ERROR_RETURN_TRACE_LEN > 0 && (STJ_ERROR_RETURN_TRACE_LEN & (STJ_ERROR_RETURN_TRACE_LEN - 1)) == 0,
+        "STJ_ERROR_RETURN_TRACE_LEN must be a power of two"
+    );
+
+    struct ErrorReturnTrace {
+        struct Entry {
+            const stj::debug::ErrorReturnSite* site;
+            void* return_address;
+        };
+
+        Entry entries[STJ_ERROR_RETURN_TRACE_LEN];
+        std::size_t count;
+    };
+
+    inline thread_local ErrorReturnTrace error_return_trace = {};
+
+    [[gnu::always_inline]] inline void pushErrorReturn(const stj::debug::ErrorReturnSite* site, void* return_address) {
+        ErrorReturnTrace& trace = error_return_trace;
+        trace.entries[trace.count & (STJ_ERROR_RETURN_TRACE_LEN - 1)] = {site, return_address};
+        trace.count++;
+    }
+}
+
+#define STJ_PUSH_ERROR_RETURN() do { \
+    static const ::stj::debug::ErrorReturnSite _stj_error_return_site{__FILE__, __LINE__, __func__}; \
+    ::__stj_basic_impl::pushErrorReturn(&_stj_error_return_site, __builtin_return_address(0)); \
+} while(0)
+#else
+#define STJ_PUSH_ERROR_RETURN() do {} while(0)
+#endif
+
+namespace stj {
+    namespace debug {
+        // Forget the recorded trace, call this once an error has been handled.
+        inline void clearErrorReturnTrace() {
+            #ifdef STJ_ERROR_RETURN_TRACE
+                __stj_basic_impl::error_return_trace.count = 0;
+            #endif
+        }
+
+        // Print the current thread's trace to stderr, oldest propagation first.
+        inline void dumpErrorReturnTrace() {
+            #ifdef STJ_ERROR_RETURN_TRACE
+                const __stj_basic_impl::ErrorReturnTrace& trace = __stj_basic_impl::error_return_trace;
+                std::size_t len = trace.count < STJ_ERROR_RETURN_TRACE_LEN ? trace.count : STJ_ERROR_RETURN_TRACE_LEN;
+                std::size_t first = trace.count - len;
+
+                std::fprintf(stderr, "error return trace (%zu entries", len);
+                if (first != 0) std::fprintf(stderr, ", %zu older dropped", first);
+                std::fprintf(stderr, "):\n");
+
+                for (std::size_t i = first; i < trace.count; i++) {
+                    const auto& entry = trace.entries[i & (STJ_ERROR_RETURN_TRACE_LEN - 1)];
+                    std::fprintf(stderr, "  #%zu %s:%d in %s\n", i - first, entry.site->file, entry.site->line, entry.site->function);
+                    std::fflush(stderr);
+                    #if __has_include(<execinfo.h>)
+                        std::fprintf(stderr, "     returned to: ");
+                        std::fflush(stderr);
+                        void* address = entry.return_address;
+                        backtrace_symbols_fd(&address, 1, fileno(stderr));
+                    #else
+                        std::fprintf(stderr, "     returned to: %p\n", entry.return_address);
+                    #endif
+                }
+            #endif
+        }
+    }
+}
+// ==== error return trace
+
 // errdefer ====
 // TODO: check for the type of _result_temp
 #define TRY(expr) ({ \
     auto _result_temp = (expr); \
     __stj_basic_impl::error = _result_temp.hasAnyError(); \
-    if (__stj_basic_impl::error) { \
+    if (__stj_basic_impl::error) [[unlikely]] { \
+        STJ_PUSH_ERROR_RETURN(); \
         return _result_temp; \
     } \
     _result_temp.value(); \
@@ -726,27 +1294,27 @@ template <typename T>
 class Ptr {
 private:
     struct PrivateTag {};
-    Ptr(T* p, PrivateTag) : raw_ptr(p) {} // workaround for creating a Ptr with a nullptr for undefined
+    constexpr Ptr(T* p, PrivateTag) : raw_ptr(p) {} // workaround for creating a Ptr with a nullptr for undefined
 public:
     // TODO support void pointer
     T* raw_ptr;
     
-    Ptr(T* p) : raw_ptr(p) {
+    constexpr Ptr(T* p) : raw_ptr(p) {
         if (p == nullptr) {
             PANIC("Cannot initialize Ptr with nullptr");
         }
     }
     
-    static Ptr<T> undefined() {
+    static constexpr Ptr<T> undefined() {
         return Ptr<T>(nullptr, PrivateTag{});
     }
 
-    T& v() const {
+    constexpr T& v() const {
         return *raw_ptr;
     }
     
     template <typename... Args>
-    auto operator()(Args&&... args) const -> decltype((*raw_ptr)(std::forward<Args>(args)...)) {
+    constexpr auto operator()(Args&&... args) const -> decltype((*raw_ptr)(std::forward<Args>(args)...)) {
         return (*raw_ptr)(std::forward<Args>(args)...);
     }
 };
@@ -759,35 +1327,43 @@ template <typename T> struct Slice;
 template <typename T>
 class MiPtr {
 private:
+    template <typename U> friend class MiPtr;
     struct PrivateTag {};
-    MiPtr(T* p, PrivateTag) : raw_ptr(p) {} // workaround for creating a Ptr with a nullptr for undefined
+    constexpr MiPtr(T* p, PrivateTag) : raw_ptr(p) {} // workaround for creating a Ptr with a nullptr for undefined
 public:
     T* raw_ptr;
 
-    MiPtr(T* p) : raw_ptr(p) {
+    constexpr MiPtr(T* p) : raw_ptr(p) {
         if (p == nullptr) [[unlikely]] {
             PANIC("Cannot initialize MiPtr with nullptr");
         }
     }
 
-    static MiPtr<T> undefined() {
+    static constexpr MiPtr<T> undefined() {
         return MiPtr<T>(nullptr, PrivateTag{});
     }
     
-    T& operator[] (usize index) {
+    constexpr T& operator[] (usize index) const {
         return raw_ptr[index];
     }
 
-    Slice<T> slice(usize start, usize end) {
+    constexpr Slice<T> slice(usize start, usize end) const {
         if (start > end) [[unlikely]] {
             PANIC("start is greater than end");
         }
-        MiPtr<T> shifted_ptr = raw_ptr + start;
+        // Offsetting keeps an undefined pointer undefined, so empty slices
+        // can be sliced too.
+        MiPtr<T> shifted_ptr(raw_ptr + start, PrivateTag{});
         return Slice<T>{shifted_ptr, end - start};
     }
 
-    MiPtr<T> slice(usize start) {
-        return MiPtr<T>(raw_ptr + start);
+    constexpr MiPtr<T> slice(usize start) const {
+        return MiPtr<T>(raw_ptr + start, PrivateTag{});
+    }
+
+    template <typename U = T, typename = std::enable_if_t<!std::is_const_v<U>>>
+    constexpr operator MiPtr<const U>() const {
+        return MiPtr<const U>(raw_ptr, typename MiPtr<const U>::PrivateTag{});
     }
 };
 // ==== many items pointer
@@ -798,19 +1374,19 @@ struct Slice {
     MiPtr<T> ptr;
     usize len;
 
-    T& operator[] (usize index) {
+    constexpr T& operator[] (usize index) const {
         if (index >= len) [[unlikely]] {
             PANIC("index is greater than slice bound");
         }
         return ptr[index];
     }
 
-    static Slice empty() {
+    static constexpr Slice empty() {
         return Slice{MiPtr<T>::undefined(), 0};
     }
 
-    Slice<T> slice(usize start, usize end) {
-        if (end >= len) [[unlikely]] {
+    constexpr Slice<T> slice(usize start, usize end) const {
+        if (end > len) [[unlikely]] {
             PANIC("end is greater than slice bound");
         }
         if (start > end) [[unlikely]] {
@@ -820,16 +1396,269 @@ struct Slice {
         return Slice<T>{shifted_ptr, end - start};
     }
 
-    Slice<T> slice(usize start) {
-        if (start >= len) [[unlikely]] {
+    constexpr Slice<T> slice(usize start) const {
+        if (start > len) [[unlikely]] {
             PANIC("start is greater than slice bound");
         }
         MiPtr<T> shifted_ptr = ptr.slice(start);
         return Slice<T>{shifted_ptr, len - start};
     }
+
+    template <typename U = T, typename = std::enable_if_t<!std::is_const_v<U>>>
+    constexpr operator Slice<const U>() const {
+        return Slice<const U>{ptr, len};
+    }
 };
 // ==== Slice
 
+// Array ====
+// Fixed-size array whose length is part of the type. `get<I>()` is bounds
+// checked at compile time, runtime indices are compared against the constant
+// N which lets the optimizer drop the check for range-proven indices.
+template <typename T, std::size_t N>
+struct Array {
+    static_assert(N > 0, "Array length must be greater than zero");
+
+    T items[N];
+
+    static constexpr usize len = N;
+
+    constexpr T& operator[] (usize index) {
+        if (index >= N) [[unlikely]] {
+            PANIC("index is greater than array bound");
+        }
+        return items[index];
+    }
+
+    constexpr const T& operator[] (usize index) const {
+        if (index >= N) [[unlikely]] {
+            PANIC("index is greater than array bound");
+        }
+        return items[index];
+    }
+
+    template <std::size_t I>
+    constexpr T& get() {
+        static_assert(I < N, "index is greater than array bound");
+        return items[I];
+    }
+
+    template <std::size_t I>
+    constexpr const T& get() const {
+        static_assert(I < N, "index is greater than array bound");
+        return items[I];
+    }
+
+    constexpr Slice<T> slice() {
+        return Slice<T>{MiPtr<T>(items), len};
+    }
+
+    constexpr Slice<const T> slice() const {
+        return Slice<const T>{MiPtr<const T>(items), len};
+    }
+
+    constexpr operator Slice<T>() {
+        return slice();
+    }
+
+    constexpr operator Slice<const T>() const {
+        return slice();
+    }
+};
+// ==== Array
+
+// integer kernels ====
+namespace __stj_basic_impl {
+    template <typename T>
+    struct type_identity {
+        using type = T;
+    };
+
+    template <typename T>
+    using type_identity_t = typename type_identity<T>::type;
+
+    // PADDS/PADDUS and PSUBS/PSUBUS only exist for 8 and 16 bit lanes.
+    template <typename T>
+    constexpr bool has_simd_saturation = std::is_integral_v<T> && sizeof(T) <= 2;
+
+#if defined(__SSE2__)
+    template <typename T>
+    inline __m128i addSat128(__m128i a, __m128i b) {
+        if constexpr (sizeof(T) == 1) {
+            return std::is_signed_v<T> ? _mm_adds_epi8(a, b) : _mm_adds_epu8(a, b);
+        } else {
+            return std::is_signed_v<T> ? _mm_adds_epi16(a, b) : _mm_adds_epu16(a, b);
+        }
+    }
+
+    template <typename T>
+    inline __m128i subSat128(__m128i a, __m128i b) {
+        if constexpr (sizeof(T) == 1) {
+            return std::is_signed_v<T> ? _mm_subs_epi8(a, b) : _mm_subs_epu8(a, b);
+        } else {
+            return std::is_signed_v<T> ? _mm_subs_epi16(a, b) : _mm_subs_epu16(a, b);
+        }
+    }
+#endif
+
+#if defined(__AVX2__)
+    template <typename T>
+    inline __m256i addSat256(__m256i a, __m256i b) {
+        if constexpr (sizeof(T) == 1) {
+            return std::is_signed_v<T> ? _mm256_adds_epi8(a, b) : _mm256_adds_epu8(a, b);
+        } else {
+            return std::is_signed_v<T> ? _mm256_adds_epi16(a, b) : _mm256_adds_epu16(a, b);
+        }
+    }
+
+    template <typename T>
+    inline __m256i subSat256(__m256i a, __m256i b) {
+        if constexpr (sizeof(T) == 1) {
+            return std::is_signed_v<T> ? _mm256_subs_epi8(a, b) : _mm256_subs_epu8(a, b);
+        } else {
+            return std::is_signed_v<T> ? _mm256_subs_epi16(a, b) : _mm256_subs_epu16(a, b);
+        }
+    }
+#endif
+
+    // Returns how many leading items were handled with vector instructions.
+    template <typename T, bool Add>
+    inline std::size_t saturateVectorized(T* dst, const T* a, const T* b, std::size_t len) {
+        std::size_t i = 0;
+        if constexpr (has_simd_saturation<T>) {
+#if defined(__AVX2__)
+            for (; i + 32 / sizeof(T) <= len; i += 32 / sizeof(T)) {
+                __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+                __m256i vr = Add ? addSat256<T>(va, vb) : subSat256<T>(va, vb);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), vr);
+            }
+#endif
+#if defined(__SSE2__)
+            for (; i + 16 / sizeof(T) <= len; i += 16 / sizeof(T)) {
+                __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                __m128i vr = Add ? addSat128<T>(va, vb) : subSat128<T>(va, vb);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), vr);
+            }
+#endif
+        }
+        (void)dst; (void)a; (void)b; (void)len;
+        return i;
+    }
+
+    // PMULLW covers 16 bit lanes, PMULLD needs SSE4.1, 8 and 64 bit lanes stay scalar.
+    template <typename T>
+    inline std::size_t mulAddVectorized(T* acc, const T* a, const T* b, std::size_t len) {
+        std::size_t i = 0;
+#if defined(__AVX2__)
+        if constexpr (sizeof(T) == 2 || sizeof(T) == 4) {
+            for (; i + 32 / sizeof(T) <= len; i += 32 / sizeof(T)) {
+                __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+                __m256i vc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + i));
+                __m256i vp = sizeof(T) == 2 ? _mm256_mullo_epi16(va, vb) : _mm256_mullo_epi32(va, vb);
+                __m256i vr = sizeof(T) == 2 ? _mm256_add_epi16(vc, vp) : _mm256_add_epi32(vc, vp);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + i), vr);
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        if constexpr (sizeof(T) == 2) {
+            for (; i + 8 <= len; i += 8) {
+                __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), _mm_add_epi16(vc, _mm_mullo_epi16(va, vb)));
+            }
+        }
+#endif
+#if defined(__SSE4_1__)
+        if constexpr (sizeof(T) == 4) {
+            for (; i + 4 <= len; i += 4) {
+                __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(acc + i), _mm_add_epi32(vc, _mm_mullo_epi32(va, vb)));
+            }
+        }
+#endif
+        (void)acc; (void)a; (void)b; (void)len;
+        return i;
+    }
+}
+
+namespace stj {
+    namespace math {
+        // dst[i] = a[i] + b[i], clamped. `dst` may be the same slice as `a` or `b`.
+        template <typename T>
+        void addSat(
+            Slice<SatInt<T>> dst,
+            __stj_basic_impl::type_identity_t<Slice<const SatInt<T>>> a,
+            __stj_basic_impl::type_identity_t<Slice<const SatInt<T>>> b
+        ) {
+            if (a.len != dst.len || b.len != dst.len) [[unlikely]] {
+                PANIC("slice lengths do not match");
+            }
+            std::size_t len = dst.len;
+            std::size_t i = __stj_basic_impl::saturateVectorized<T, true>(
+                reinterpret_cast<T*>(dst.ptr.raw_ptr),
+                reinterpret_cast<const T*>(a.ptr.raw_ptr),
+                reinterpret_cast<const T*>(b.ptr.raw_ptr),
+                len
+            );
+            for (; i < len; i++) {
+                dst.ptr.raw_ptr[i] = a.ptr.raw_ptr[i] + b.ptr.raw_ptr[i];
+            }
+        }
+
+        // dst[i] = a[i] - b[i], clamped. `dst` may be the same slice as `a` or `b`.
+        template <typename T>
+        void subSat(
+            Slice<SatInt<T>> dst,
+            __stj_basic_impl::type_identity_t<Slice<const SatInt<T>>> a,
+            __stj_basic_impl::type_identity_t<Slice<const SatInt<T>>> b
+        ) {
+            if (a.len != dst.len || b.len != dst.len) [[unlikely]] {
+                PANIC("slice lengths do not match");
+            }
+            std::size_t len = dst.len;
+            std::size_t i = __stj_basic_impl::saturateVectorized<T, false>(
+                reinterpret_cast<T*>(dst.ptr.raw_ptr),
+                reinterpret_cast<const T*>(a.ptr.raw_ptr),
+                reinterpret_cast<const T*>(b.ptr.raw_ptr),
+                len
+            );
+            for (; i < len; i++) {
+                dst.ptr.raw_ptr[i] = a.ptr.raw_ptr[i] - b.ptr.raw_ptr[i];
+            }
+        }
+
+        // acc[i] += a[i] * b[i], wrapping.
+        template <typename T>
+        void mulAddWrap(
+            Slice<WrapInt<T>> acc,
+            __stj_basic_impl::type_identity_t<Slice<const WrapInt<T>>> a,
+            __stj_basic_impl::type_identity_t<Slice<const WrapInt<T>>> b
+        ) {
+            if (a.len != acc.len || b.len != acc.len) [[unlikely]] {
+                PANIC("slice lengths do not match");
+            }
+            std::size_t len = acc.len;
+            std::size_t i = __stj_basic_impl::mulAddVectorized<T>(
+                reinterpret_cast<T*>(acc.ptr.raw_ptr),
+                reinterpret_cast<const T*>(a.ptr.raw_ptr),
+                reinterpret_cast<const T*>(b.ptr.raw_ptr),
+                len
+            );
+            for (; i < len; i++) {
+                acc.ptr.raw_ptr[i] += a.ptr.raw_ptr[i] * b.ptr.raw_ptr[i];
+            }
+        }
+    }
+}
+// ==== integer kernels
+
 namespace stj {
     namespace heap {
         struct AllocatorVTable {
@@ -859,52 +1688,39 @@ namespace stj {
             Ptr<void(void* ctx, Slice<u8> buf)> free;
         };
 
-        // Allocator interface
-        struct Allocator {
-            void* impl_data;
-            const AllocatorVTable* vtable;
+        struct Allocator;
 
-            // Allocate a slice of bytes of given capacity
-            template <typename T>
-            Slice<T> alloc(usize count) {
+        // Returned by the fallible helpers instead of panicking, for containers
+        // whose callers can recover from running out of memory.
+        enum class AllocError {
+            OutOfMemory,
+        };
+
+        // Typed helpers shared by the type-erased Allocator and by concrete
+        // allocators. `A` only needs rawAlloc, rawResize and rawFree with the
+        // semantics of the matching AllocatorVTable entries.
+        namespace typed {
+            template <typename T, typename A>
+            Slice<T> alloc(A& allocator, usize count) {
                 usize byte_size = count * sizeof(T);
-                Slice<u8> bytes = vtable->alloc(impl_data, byte_size);
+                Slice<u8> bytes = allocator.rawAlloc(byte_size);
                 if (bytes.len == 0) [[unlikely]] {
                     PANIC("Memory allocation failed");
                 }
                 return Slice<T>{MiPtr<T>(reinterpret_cast<T*>(bytes.ptr.raw_ptr)), count};
             }
 
-            // Deallocate a previously allocated slice
-            template <typename T>
-            void free(Slice<T> slice) {
+            template <typename T, typename A>
+            void free(A& allocator, Slice<T> slice) {
                 Slice<u8> bytes{
                     MiPtr<u8>(reinterpret_cast<u8*>(slice.ptr.raw_ptr)), // TODO: make a cast function for Ptr<>?
                     slice.len * sizeof(T)
                 };
-                vtable->free(impl_data, bytes);
-            }
-            
-            // Create a single item
-            template <typename T>
-            Ptr<T> create() {
-                Slice<T> memory = alloc<T>(1);
-                return memory.ptr;
-            }
-            
-            // Destroy a single item
-            template <typename T>
-            void destroy(Ptr<T> item) {
-                Slice<u8> bytes{
-                    MiPtr<u8>(reinterpret_cast<u8*>(item.get_raw_ptr)), 
-                    sizeof(T)
-                };
-                vtable->free(impl_data, bytes);
+                allocator.rawFree(bytes);
             }
 
-            // Resize an existing allocation
-            template <typename T>
-            Slice<T> realloc(Slice<T> old_slice, usize new_count) {
+            template <typename T, typename A>
+            Slice<T> realloc(A& allocator, Slice<T> old_slice, usize new_count) {
                 usize new_byte_size = new_count * sizeof(T);
                 
                 Slice<u8> bytes{
@@ -912,12 +1728,12 @@ namespace stj {
                     old_slice.len * sizeof(T)
                 };
                 
-                bool success = vtable->resize(impl_data, bytes, new_byte_size);
+                bool success = allocator.rawResize(bytes, new_byte_size);
                 
                 if (success) {
                     return Slice<T>{old_slice.ptr, new_count};
                 } else {
-                    Slice<T> new_slice = alloc<T>(new_count);
+                    Slice<T> new_slice = alloc<T>(allocator, new_count);
                     
                     usize copy_count; 
                     if (old_slice.len < new_count) {
@@ -930,12 +1746,170 @@ namespace stj {
                         new_slice[i] = old_slice[i];
                     }
                     
-                    free(old_slice);
+                    free(allocator, old_slice);
                     
                     return new_slice;
                 }
             }
+
+            // Byte size of `count` items, false when it does not fit in a usize.
+            template <typename T>
+            bool tryByteSize(usize count, std::size_t& byte_size) {
+                return !__builtin_mul_overflow(count.raw(), sizeof(T), &byte_size);
+            }
+
+            // Reports a size overflow as OutOfMemory, zero items give an
+            // empty slice.
+            template <typename T, typename A>
+            Result<Slice<T>, AllocError> tryAlloc(A& allocator, usize count) {
+                if (count.raw() == 0) {
+                    return Slice<T>::empty();
+                }
+                std::size_t byte_size;
+                if (!tryByteSize<T>(count, byte_size)) [[unlikely]] {
+                    return AllocError::OutOfMemory;
+                }
+                Slice<u8> bytes = allocator.rawAlloc(byte_size);
+                if (bytes.len == 0) [[unlikely]] {
+                    return AllocError::OutOfMemory;
+                }
+                return Slice<T>{MiPtr<T>(reinterpret_cast<T*>(bytes.ptr.raw_ptr)), count};
+            }
+
+            // Like realloc, but leaves `old_slice` untouched and reports
+            // OutOfMemory when neither resizing nor moving succeeds.
+            template <typename T, typename A>
+            Result<Slice<T>, AllocError> tryRealloc(A& allocator, Slice<T> old_slice, usize new_count) {
+                Slice<u8> bytes{
+                    MiPtr<u8>(reinterpret_cast<u8*>(old_slice.ptr.raw_ptr)),
+                    old_slice.len * sizeof(T)
+                };
+                std::size_t new_byte_size;
+                if (!tryByteSize<T>(new_count, new_byte_size)) [[unlikely]] {
+                    return AllocError::OutOfMemory;
+                }
+                if (allocator.rawResize(bytes, new_byte_size)) {
+                    return Slice<T>{old_slice.ptr, new_count};
+                }
+
+                Result<Slice<T>, AllocError> moved = tryAlloc<T>(allocator, new_count);
+                if (moved.hasAnyError()) [[unlikely]] {
+                    return moved;
+                }
+                Slice<T> new_slice = moved.value();
+                usize copy_count = old_slice.len < new_count ? old_slice.len : new_count;
+                for (usize i = 0; i < copy_count; i++) {
+                    new_slice[i] = old_slice[i];
+                }
+                free(allocator, old_slice);
+                return new_slice;
+            }
+        }
+
+        // Allocator interface
+        struct Allocator {
+            void* impl_data;
+            const AllocatorVTable* vtable;
+
+            Slice<u8> rawAlloc(usize len) const {
+                return vtable->alloc(impl_data, len);
+            }
+
+            bool rawResize(Slice<u8> buf, usize new_len) const {
+                return vtable->resize(impl_data, buf, new_len);
+            }
+
+            void rawFree(Slice<u8> buf) const {
+                vtable->free(impl_data, buf);
+            }
+
+            // Allocate a slice of bytes of given capacity
+            template <typename T>
+            Slice<T> alloc(usize count) const {
+                return typed::alloc<T>(*this, count);
+            }
+
+            // Deallocate a previously allocated slice
+            template <typename T>
+            void free(Slice<T> slice) const {
+                typed::free(*this, slice);
+            }
+            
+            // Create a single item
+            template <typename T>
+            Ptr<T> create() const {
+                Slice<T> memory = alloc<T>(1);
+                return memory.ptr.raw_ptr;
+            }
+            
+            // Destroy a single item
+            template <typename T>
+            void destroy(Ptr<T> item) const {
+                free(Slice<T>{MiPtr<T>(item.raw_ptr), 1});
+            }
+
+            // Resize an existing allocation
+            template <typename T>
+            Slice<T> realloc(Slice<T> old_slice, usize new_count) const {
+                return typed::realloc(*this, old_slice, new_count);
+            }
+        };
+
+        // Same helpers as Allocator for concrete allocators, which call their
+        // raw functions directly so the compiler can inline them.
+        template <typename Self>
+        struct AllocatorMethods {
+            template <typename T>
+            Slice<T> alloc(usize count) {
+                return typed::alloc<T>(self(), count);
+            }
+
+            template <typename T>
+            void free(Slice<T> slice) {
+                typed::free(self(), slice);
+            }
+
+            template <typename T>
+            Ptr<T> create() {
+                Slice<T> memory = alloc<T>(1);
+                return memory.ptr.raw_ptr;
+            }
+
+            template <typename T>
+            void destroy(Ptr<T> item) {
+                free(Slice<T>{MiPtr<T>(item.raw_ptr), 1});
+            }
+
+            template <typename T>
+            Slice<T> realloc(Slice<T> old_slice, usize new_count) {
+                return typed::realloc(self(), old_slice, new_count);
+            }
+
+        private:
+            Self& self() {
+                return static_cast<Self&>(*this);
+            }
         };
+
+        template <typename A, typename = void>
+        struct is_allocator : std::false_type {};
+
+        template <typename A>
+        struct is_allocator<A, std::void_t<
+            std::enable_if_t<std::is_same_v<decltype(std::declval<A&>().rawAlloc(std::declval<usize>())), Slice<u8>>>,
+            std::enable_if_t<std::is_same_v<decltype(std::declval<A&>().rawResize(std::declval<Slice<u8>>(), std::declval<usize>())), bool>>,
+            decltype(std::declval<A&>().rawFree(std::declval<Slice<u8>>()))
+        >> : std::true_type {};
+
+        // Compile-time allocator check, concrete allocators are usually built
+        // on AllocatorMethods.
+        template <typename A>
+        constexpr bool is_allocator_v = is_allocator<A>::value;
+
+        // Type-erased allocators are passed around by value, concrete ones
+        // by reference since they may carry state.
+        template <typename A>
+        using AllocatorRef = std::conditional_t<std::is_same_v<A, Allocator>, Allocator, A&>;
         
         namespace c_allocator_impl {
             namespace extern_c {
@@ -967,11 +1941,11 @@ namespace stj {
             }
 
             static Slice<u8> malloc_alloc(void* /*ctx*/, usize size) {
-                if (size == 0) return {MiPtr<u8>(nullptr), 0};
+                if (size == 0) return {MiPtr<u8>::undefined(), 0};
                 
                 u8* ptr = static_cast<u8*>(::malloc(size));
                 if (ptr == nullptr) [[unlikely]] {
-                    return {MiPtr<u8>(nullptr), 0};
+                    return {MiPtr<u8>::undefined(), 0};
                 }
                 
                 return {MiPtr<u8>(ptr), size};
@@ -996,28 +1970,128 @@ namespace stj {
             nullptr,
             &c_allocator_impl::malloc_vtable
         };
-    }
 
-    template <typename T>
-    struct ArrayList {
-        Slice<T> items;
-        usize capacity;
+        // Statically dispatched counterpart of c_allocator.
+        struct CAllocator : AllocatorMethods<CAllocator> {
+            Slice<u8> rawAlloc(usize len) {
+                return c_allocator_impl::malloc_alloc(nullptr, len);
+            }
 
-        static ArrayList<T> init() {
-            return { 
-                .items = Slice<T>::empty(),
+            bool rawResize(Slice<u8> buf, usize new_len) {
+                return c_allocator_impl::malloc_resize(nullptr, buf, new_len);
+            }
+
+            void rawFree(Slice<u8> buf) {
+                c_allocator_impl::malloc_free(nullptr, buf);
+            }
+
+            Allocator allocator() const {
+                return c_allocator;
+            }
+        };
+
+        // Bump allocator over a caller-provided buffer. Every allocation is
+        // aligned to alignof(std::max_align_t); only the most recent allocation
+        // can be resized in place or given back by free.
+        struct FixedBufferAllocator : AllocatorMethods<FixedBufferAllocator> {
+            Slice<u8> buffer;
+            usize end_index;
+
+            static FixedBufferAllocator init(Slice<u8> buffer) {
+                return {{}, buffer, 0};
+            }
+
+            void reset() {
+                end_index = 0;
+            }
+
+            bool ownsLast(Slice<u8> buf) const {
+                return buf.ptr.raw_ptr + buf.len == buffer.ptr.raw_ptr + end_index;
+            }
+
+            Slice<u8> rawAlloc(usize len) {
+                constexpr std::size_t alignment = alignof(std::max_align_t);
+                std::uintptr_t base = reinterpret_cast<std::uintptr_t>(buffer.ptr.raw_ptr);
+                std::uintptr_t start = (base + end_index + (alignment - 1)) & ~std::uintptr_t(alignment - 1);
+                std::size_t offset = start - base;
+                if (len == 0 || offset > buffer.len || len > buffer.len - offset) [[unlikely]] {
+                    return {MiPtr<u8>::undefined(), 0};
+                }
+                end_index = offset + len;
+                return {MiPtr<u8>(buffer.ptr.raw_ptr + offset), len};
+            }
+
+            bool rawResize(Slice<u8> buf, usize new_len) {
+                if (!ownsLast(buf)) {
+                    return new_len <= buf.len;
+                }
+                std::size_t offset = buf.ptr.raw_ptr - buffer.ptr.raw_ptr;
+                if (new_len > buffer.len - offset) {
+                    return false;
+                }
+                end_index = offset + new_len;
+                return true;
+            }
+
+            void rawFree(Slice<u8> buf) {
+                if (ownsLast(buf)) {
+                    end_index -= buf.len;
+                }
+            }
+
+            // Type-erased view, valid as long as this allocator is alive.
+            Allocator allocator() {
+                return {this, &vtable};
+            }
+
+        private:
+            static Slice<u8> vtableAlloc(void* ctx, usize len) {
+                return static_cast<FixedBufferAllocator*>(ctx)->rawAlloc(len);
+            }
+
+            static bool vtableResize(void* ctx, Slice<u8> buf, usize new_len) {
+                return static_cast<FixedBufferAllocator*>(ctx)->rawResize(buf, new_len);
+            }
+
+            static void vtableFree(void* ctx, Slice<u8> buf) {
+                static_cast<FixedBufferAllocator*>(ctx)->rawFree(buf);
+            }
+
+            static inline const AllocatorVTable vtable = {
+                vtableAlloc,
+                vtableResize,
+                vtableFree
+            };
+        };
+    }
+
+    template <typename T, typename A = heap::Allocator>
+    struct ArrayList {
+        static_assert(heap::is_allocator_v<A>, "ArrayList needs an allocator type");
+
+        using AllocatorRef = heap::AllocatorRef<A>;
+
+        Slice<T> items;
+        usize capacity;
+
+        static ArrayList<T, A> init() {
+            return { 
+                .items = Slice<T>::empty(),
                 .capacity = 0 
             };
         }
 
-        void deinit(heap::Allocator alloc) {
+        void deinit(AllocatorRef alloc) {
+            if (capacity == 0) {
+                return;
+            }
             alloc.free(items.ptr.slice(0, capacity));
         }
 
-        void append(heap::Allocator alloc, T item) {
+        void append(AllocatorRef alloc, T item) {
             if (capacity == 0) {
                 capacity = 16;
-                Slice<T> buff = alloc.alloc<T>(capacity);
+                Slice<T> buff = alloc.template alloc<T>(capacity);
                 items = buff.slice(0, 1);
                 items[0] = item;
                 return;
@@ -1037,11 +2111,65 @@ namespace stj {
             return;
         }
 
-        T pop(heap::Allocator alloc) {
+        void appendSlice(AllocatorRef alloc, Slice<const T> new_items) {
+            usize new_len = items.len + new_items.len;
+            if (capacity < new_len) {
+                usize new_capacity = capacity == 0 ? usize(16) : capacity;
+                while (new_capacity < new_len) {
+                    new_capacity *= 2;
+                }
+                Slice<T> buff = capacity == 0
+                    ? alloc.template alloc<T>(new_capacity)
+                    : alloc.realloc(items.ptr.slice(0, capacity), new_capacity);
+                items = buff.slice(0, items.len);
+                capacity = new_capacity;
+            }
+
+            T* dest = items.ptr.raw_ptr + items.len.raw();
+            if constexpr (std::is_trivially_copyable_v<T>) {
+                if (new_items.len > 0) {
+                    std::memcpy(dest, new_items.ptr.raw_ptr, new_items.len.raw() * sizeof(T));
+                }
+            } else {
+                for (usize i = 0; i < new_items.len; i++) {
+                    dest[i.raw()] = new_items.ptr.raw_ptr[i.raw()];
+                }
+            }
+            items = items.ptr.slice(0, new_len);
+        }
+
+        // Grows the backing buffer to hold at least `new_capacity` items,
+        // reporting OutOfMemory instead of panicking. The list is unchanged
+        // on failure.
+        Error<heap::AllocError> ensureTotalCapacity(AllocatorRef alloc, usize new_capacity) {
+            if (new_capacity <= capacity) {
+                return {};
+            }
+            std::size_t better_capacity = capacity == 0 ? 16 : capacity.raw();
+            while (better_capacity < new_capacity.raw()) {
+                if (__builtin_mul_overflow(better_capacity, 2, &better_capacity)) [[unlikely]] {
+                    better_capacity = new_capacity.raw();
+                    break;
+                }
+            }
+
+            Result<Slice<T>, heap::AllocError> buff = capacity == 0
+                ? heap::typed::tryAlloc<T>(alloc, better_capacity)
+                : heap::typed::tryRealloc(alloc, items.ptr.slice(0, capacity), better_capacity);
+            if (buff.hasAnyError()) [[unlikely]] {
+                return heap::AllocError::OutOfMemory;
+            }
+            items = buff.value().slice(0, items.len);
+            capacity = usize(better_capacity);
+            return {};
+        }
+
+        T pop(AllocatorRef alloc) {
             if (items.len < capacity/4) {
                 usize new_capacity = capacity/2;
                 Slice<T> buff = alloc.realloc(items.ptr.slice(0, capacity), new_capacity);
-                items = buff.slice(0, new_capacity);
+                items = buff.slice(0, items.len);
+                capacity = new_capacity;
             }
 
             T result = items[items.len - 1];
@@ -1050,14 +2178,5493 @@ namespace stj {
         }
     };
 
+}
+
+// priority queue ====
+namespace stj {
+    enum class PriorityQueueError {
+        Empty,
+        ElementNotFound,
+    };
+
+    // d-ary min-heap ordered by `Compare`: the item for which compare(a, b)
+    // holds against every other item is removed first, so std::less gives the
+    // smallest item (the opposite of std::priority_queue). A node's D children
+    // are adjacent, so with D = 4 and 8 byte items one sift-down step reads a
+    // single cache line and the tree is half as deep as a binary heap.
+    template <typename T, typename Compare = std::less<T>, std::size_t D = 4, typename A = heap::Allocator>
+    struct PriorityQueue {
+        static_assert(D >= 2, "PriorityQueue arity must be at least 2");
 
-    // TODO: made it a macro/a generic
-    void println(const char* str) {
-        std::printf("%s\n", str);
-    }
-    
-    template <typename T, typename... Args>
-    void print(const T& first, const Args&... args) {
-        std::printf(first, args...);
-    }
+        using AllocatorRef = heap::AllocatorRef<A>;
+        static constexpr std::size_t cache_line_bytes = 64;
+        static constexpr std::size_t prefetch_bytes = D * D * sizeof(T) < 2 * cache_line_bytes
+            ? D * D * sizeof(T)
+            : 2 * cache_line_bytes;
+
+        ArrayList<T, A> list;
+        Compare compare;
+
+        static PriorityQueue init(Compare compare = Compare{}) {
+            return {ArrayList<T, A>::init(), compare};
+        }
+
+        void deinit(AllocatorRef alloc) {
+            list.deinit(alloc);
+            list = ArrayList<T, A>::init();
+        }
+
+        usize count() const {
+            return list.items.len;
+        }
+
+        Error<heap::AllocError> add(AllocatorRef alloc, T item) {
+            std::size_t len = list.items.len.raw();
+            Error<heap::AllocError> grown = list.ensureTotalCapacity(alloc, len + 1);
+            if (grown.hasError()) [[unlikely]] {
+                return grown;
+            }
+            list.items = list.items.ptr.slice(0, len + 1);
+            siftUp(len, item);
+            return {};
+        }
+
+        // Adds all items with one capacity check. Large batches are heapified
+        // bottom-up in O(n) instead of being sifted up one by one.
+        Error<heap::AllocError> addSlice(AllocatorRef alloc, Slice<const T> new_items) {
+            std::size_t old_len = list.items.len.raw();
+            std::size_t added = new_items.len.raw();
+            Error<heap::AllocError> grown = list.ensureTotalCapacity(alloc, old_len + added);
+            if (grown.hasError()) [[unlikely]] {
+                return grown;
+            }
+            list.items = list.items.ptr.slice(0, old_len + added);
+
+            T* items = list.items.ptr.raw_ptr;
+            if (added >= old_len) {
+                for (std::size_t i = 0; i < added; i++) {
+                    items[old_len + i] = new_items.ptr.raw_ptr[i];
+                }
+                std::size_t len = old_len + added;
+                std::size_t parents = len > 1 ? (len - 2) / D + 1 : 0;
+                for (std::size_t i = parents; i-- > 0;) {
+                    siftDown(i, items[i]);
+                }
+            } else {
+                for (std::size_t i = 0; i < added; i++) {
+                    siftUp(old_len + i, new_items.ptr.raw_ptr[i]);
+                }
+            }
+            return {};
+        }
+
+        Result<T, PriorityQueueError> peek() const {
+            if (list.items.len == 0) {
+                return PriorityQueueError::Empty;
+            }
+            return list.items.ptr.raw_ptr[0];
+        }
+
+        // Removes and returns the first item, or Empty. Never shrinks the
+        // backing buffer.
+        Result<T, PriorityQueueError> removeOrNull() {
+            std::size_t len = list.items.len.raw();
+            if (len == 0) {
+                return PriorityQueueError::Empty;
+            }
+            T* items = list.items.ptr.raw_ptr;
+            T top = items[0];
+            T last = items[len - 1];
+            list.items = list.items.ptr.slice(0, len - 1);
+            if (len > 1) {
+                siftLast(last);
+            }
+            return top;
+        }
+
+        // Replaces the first item equal to `old_item` and restores the heap
+        // order. Finding the item is a linear scan.
+        Error<PriorityQueueError> update(const T& old_item, T new_item) {
+            T* items = list.items.ptr.raw_ptr;
+            std::size_t len = list.items.len.raw();
+            for (std::size_t i = 0; i < len; i++) {
+                if (items[i] == old_item) {
+                    if (compare(new_item, items[i])) {
+                        siftUp(i, new_item);
+                    } else {
+                        siftDown(i, new_item);
+                    }
+                    return {};
+                }
+            }
+            return PriorityQueueError::ElementNotFound;
+        }
+
+    private:
+        // The winning child is unpredictable, so it is selected with a mask
+        // rather than a branch the compiler would otherwise emit.
+        std::size_t bestChild(const T* items, std::size_t first, std::size_t end) const {
+            const char* grandchildren = reinterpret_cast<const char*>(items + first * D + 1);
+            for (std::size_t offset = 0; offset < prefetch_bytes; offset += cache_line_bytes) {
+                __builtin_prefetch(grandchildren + offset);
+            }
+            std::size_t best = first;
+            for (std::size_t child = first + 1; child < end; child++) {
+                std::size_t take = std::size_t(0) - std::size_t(compare(items[child], items[best]));
+                best ^= (best ^ child) & take;
+            }
+            return best;
+        }
+
+        // Removal refills the root with the last leaf, which nearly always
+        // belongs near the bottom again. The hole is moved down to a leaf
+        // without comparing against `item`, then `item` is sifted up the
+        // few levels it needs, saving one unpredictable compare per level.
+        void siftLast(T item) {
+            T* items = list.items.ptr.raw_ptr;
+            std::size_t len = list.items.len.raw();
+            std::size_t index = 0;
+            while (true) {
+                std::size_t first = index * D + 1;
+                if (first >= len) {
+                    break;
+                }
+                std::size_t end = first + D < len ? first + D : len;
+                std::size_t best = bestChild(items, first, end);
+                items[index] = items[best];
+                index = best;
+            }
+            siftUp(index, item);
+        }
+
+        // Both sifts move a hole instead of swapping, `item` is written once.
+        void siftUp(std::size_t index, T item) {
+            T* items = list.items.ptr.raw_ptr;
+            while (index > 0) {
+                std::size_t parent = (index - 1) / D;
+                if (!compare(item, items[parent])) {
+                    break;
+                }
+                items[index] = items[parent];
+                index = parent;
+            }
+            items[index] = item;
+        }
+
+        void siftDown(std::size_t index, T item) {
+            T* items = list.items.ptr.raw_ptr;
+            std::size_t len = list.items.len.raw();
+            while (true) {
+                std::size_t first = index * D + 1;
+                if (first >= len) {
+                    break;
+                }
+                std::size_t end = first + D < len ? first + D : len;
+                std::size_t best = bestChild(items, first, end);
+                if (!compare(items[best], item)) {
+                    break;
+                }
+                items[index] = items[best];
+                index = best;
+            }
+            items[index] = item;
+        }
+    };
 }
+// ==== priority queue
+
+// thread pool ====
+namespace stj {
+    // Distance kept between data written by different threads.
+    constexpr std::size_t cache_line = 64;
+
+    namespace thread {
+        struct WaitGroup {
+            std::mutex mutex;
+            std::condition_variable cond;
+            std::size_t pending = 0;
+
+            void start(usize count = 1) {
+                std::lock_guard<std::mutex> guard(mutex);
+                pending += count;
+            }
+
+            // The last finish notifies while holding the lock so the waiter
+            // cannot return, and free the WaitGroup, before it is done with it.
+            void finish() {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (--pending == 0) {
+                    cond.notify_all();
+                }
+            }
+
+            // Blocks the calling thread, use Pool::waitAndWork from a pool task.
+            void wait() {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [this] { return pending == 0; });
+            }
+
+            bool isDone() {
+                std::lock_guard<std::mutex> guard(mutex);
+                return pending == 0;
+            }
+        };
+
+        struct Task {
+            void (*run)(Task* task);
+            Task* next;
+        };
+
+        // Chase-Lev work-stealing deque with a fixed power of two capacity.
+        // The owner pushes and pops at the bottom, thieves steal from the top.
+        // Uses seq_cst operations instead of standalone fences.
+        struct TaskDeque {
+            std::atomic<std::int64_t> top;
+            char top_padding[cache_line - sizeof(std::atomic<std::int64_t>)];
+            std::atomic<std::int64_t> bottom;
+            char bottom_padding[cache_line - sizeof(std::atomic<std::int64_t>)];
+            Slice<std::atomic<Task*>> buffer = Slice<std::atomic<Task*>>::empty();
+            std::int64_t mask;
+
+            void init(heap::Allocator allocator, usize capacity) {
+                if (capacity == 0 || (capacity & (capacity - 1)) != 0) [[unlikely]] {
+                    PANIC("deque capacity must be a power of two");
+                }
+                buffer = allocator.alloc<std::atomic<Task*>>(capacity);
+                for (usize i = 0; i < capacity; i++) {
+                    new (&buffer.ptr.raw_ptr[i]) std::atomic<Task*>(nullptr);
+                }
+                mask = static_cast<std::int64_t>(capacity.raw() - 1);
+                top.store(0, std::memory_order_relaxed);
+                bottom.store(0, std::memory_order_relaxed);
+            }
+
+            void deinit(heap::Allocator allocator) {
+                allocator.free(buffer);
+            }
+
+            // Owner only, returns false when the deque is full.
+            bool push(Task* task) {
+                std::int64_t b = bottom.load(std::memory_order_relaxed);
+                std::int64_t t = top.load(std::memory_order_acquire);
+                if (b - t > mask) {
+                    return false;
+                }
+                buffer.ptr.raw_ptr[b & mask].store(task, std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Owner only.
+            Task* pop() {
+                std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+                bottom.exchange(b, std::memory_order_seq_cst);
+                std::int64_t t = top.load(std::memory_order_seq_cst);
+                if (t > b) {
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                Task* task = buffer.ptr.raw_ptr[b & mask].load(std::memory_order_relaxed);
+                if (t == b) {
+                    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                        task = nullptr;
+                    }
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                }
+                return task;
+            }
+
+            // Any thread, returns nullptr when empty or when losing a race.
+            Task* steal() {
+                std::int64_t t = top.load(std::memory_order_seq_cst);
+                std::int64_t b = bottom.load(std::memory_order_seq_cst);
+                if (t >= b) {
+                    return nullptr;
+                }
+                Task* task = buffer.ptr.raw_ptr[t & mask].load(std::memory_order_relaxed);
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    return nullptr;
+                }
+                return task;
+            }
+        };
+
+        // Work-stealing thread pool. Initialize in place, it must not move:
+        //     stj::thread::Pool pool;
+        //     pool.init(allocator, {});
+        //     defer (pool.deinit());
+        // The allocator must be thread-safe if spawnWg is used from workers.
+        struct Pool {
+            struct Options {
+                // 0 uses std::thread::hardware_concurrency().
+                usize thread_count = 0;
+                // Must be a power of two.
+                usize deque_capacity = 1024;
+                // Bytes of scratch memory given to each worker, see scratch().
+                usize scratch_size = 0;
+            };
+
+            struct Worker {
+                TaskDeque deque;
+                Slice<u8> scratch = Slice<u8>::empty();
+                Pool* pool;
+                std::uint64_t rng;
+                std::thread thread;
+                char padding[cache_line];
+            };
+
+            heap::Allocator allocator;
+            Slice<Worker> workers = Slice<Worker>::empty();
+            std::atomic<bool> running;
+            std::atomic<std::size_t> sleeping;
+            std::mutex mutex;
+            std::condition_variable cond;
+            Task* injected_head;
+            Task* injected_tail;
+
+            static inline thread_local Worker* current_worker = nullptr;
+
+            void init(heap::Allocator alloc, Options options) {
+                allocator = alloc;
+                running.store(true, std::memory_order_relaxed);
+                sleeping.store(0, std::memory_order_relaxed);
+                injected_head = nullptr;
+                injected_tail = nullptr;
+
+                usize thread_count = options.thread_count;
+                if (thread_count == 0) {
+                    thread_count = std::thread::hardware_concurrency();
+                    if (thread_count == 0) thread_count = 1;
+                }
+
+                workers = allocator.alloc<Worker>(thread_count);
+                for (usize i = 0; i < thread_count; i++) {
+                    Worker* worker = new (&workers.ptr.raw_ptr[i]) Worker();
+                    worker->deque.init(allocator, options.deque_capacity);
+                    worker->scratch = options.scratch_size > 0
+                        ? allocator.alloc<u8>(options.scratch_size)
+                        : Slice<u8>::empty();
+                    worker->pool = this;
+                    worker->rng = 0x9E3779B97F4A7C15ull * (i.raw() + 1);
+                }
+                for (usize i = 0; i < thread_count; i++) {
+                    Worker* worker = &workers.ptr.raw_ptr[i];
+                    worker->thread = std::thread([worker] { worker->pool->workerMain(worker); });
+                }
+            }
+
+            // Workers finish all queued work before they exit.
+            void deinit() {
+                {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    running.store(false, std::memory_order_relaxed);
+                    cond.notify_all();
+                }
+                for (usize i = 0; i < workers.len; i++) {
+                    Worker& worker = workers.ptr.raw_ptr[i];
+                    worker.thread.join();
+                    worker.deque.deinit(allocator);
+                    if (worker.scratch.len > 0) {
+                        allocator.free(worker.scratch);
+                    }
+                    worker.~Worker();
+                }
+                allocator.free(workers);
+            }
+
+            // Scratch memory of the worker running the caller, empty elsewhere.
+            Slice<u8> scratch() const {
+                Worker* worker = current_worker;
+                if (worker == nullptr || worker->pool != this) {
+                    return Slice<u8>::empty();
+                }
+                return worker->scratch;
+            }
+
+            // Run `fn` on a pool thread and wait for it.
+            template <typename F>
+            void run(F&& fn) {
+                Worker* worker = current_worker;
+                if (worker != nullptr && worker->pool == this) {
+                    fn();
+                    return;
+                }
+
+                struct RunTask : Task {
+                    std::remove_reference_t<F>* fn;
+                    WaitGroup* wg;
+                };
+                WaitGroup wg;
+                wg.start();
+                RunTask task;
+                task.run = [](Task* t) {
+                    RunTask* self = static_cast<RunTask*>(t);
+                    (*self->fn)();
+                    self->wg->finish();
+                };
+                task.fn = &fn;
+                task.wg = &wg;
+                inject(&task);
+                wg.wait();
+            }
+
+            // Run `a` and `b`, possibly in parallel, and return once both are
+            // done. `b` is offered to thieves while the caller runs `a`.
+            template <typename A, typename B>
+            void join(A&& a, B&& b) {
+                Worker* worker = current_worker;
+                if (worker == nullptr || worker->pool != this) {
+                    run([&] { join(a, b); });
+                    return;
+                }
+
+                struct JoinTask : Task {
+                    std::remove_reference_t<B>* fn;
+                    std::atomic<bool> done;
+                };
+                JoinTask task;
+                task.run = [](Task* t) {
+                    JoinTask* self = static_cast<JoinTask*>(t);
+                    (*self->fn)();
+                    self->done.store(true, std::memory_order_release);
+                };
+                task.fn = &b;
+                task.done.store(false, std::memory_order_relaxed);
+
+                if (!worker->deque.push(&task)) {
+                    a();
+                    b();
+                    return;
+                }
+                wake();
+                a();
+
+                // Tasks pushed by `a` and never joined sit above ours.
+                while (Task* popped = worker->deque.pop()) {
+                    popped->run(popped);
+                    if (popped == &task) {
+                        return;
+                    }
+                }
+
+                // Stolen: help with other work until the thief is done.
+                while (!task.done.load(std::memory_order_acquire)) {
+                    Task* other = findWork(worker);
+                    if (other != nullptr) {
+                        other->run(other);
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+
+            // Run `fn` asynchronously, `wg` is finished once it returns.
+            // Closures still queued at deinit are run before it returns.
+            template <typename F>
+            void spawnWg(WaitGroup& wg, F fn) {
+                struct Closure : Task {
+                    F fn;
+                    WaitGroup* wg;
+                    Pool* pool;
+                };
+                wg.start();
+                Ptr<Closure> closure = allocator.create<Closure>();
+                new (closure.raw_ptr) Closure{{}, std::move(fn), &wg, this};
+                closure.v().run = [](Task* t) {
+                    Closure* self = static_cast<Closure*>(t);
+                    self->fn();
+                    WaitGroup* done = self->wg;
+                    Pool* pool = self->pool;
+                    self->~Closure();
+                    pool->allocator.destroy(Ptr<Closure>(self));
+                    done->finish();
+                };
+
+                Worker* worker = current_worker;
+                if (worker != nullptr && worker->pool == this) {
+                    if (worker->deque.push(closure.raw_ptr)) {
+                        wake();
+                    } else {
+                        closure.v().run(closure.raw_ptr);
+                    }
+                    return;
+                }
+                inject(closure.raw_ptr);
+            }
+
+            // Wait for `wg`. On a worker of this pool the caller runs queued
+            // tasks meanwhile, the ones it waits for may sit in its own deque.
+            void waitAndWork(WaitGroup& wg) {
+                Worker* worker = current_worker;
+                if (worker == nullptr || worker->pool != this) {
+                    wg.wait();
+                    return;
+                }
+                while (!wg.isDone()) {
+                    Task* task = findWork(worker);
+                    if (task != nullptr) {
+                        task->run(task);
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+
+        private:
+            void inject(Task* task) {
+                std::lock_guard<std::mutex> guard(mutex);
+                task->next = nullptr;
+                if (injected_tail != nullptr) {
+                    injected_tail->next = task;
+                } else {
+                    injected_head = task;
+                }
+                injected_tail = task;
+                cond.notify_one();
+            }
+
+            Task* takeInjected() {
+                std::lock_guard<std::mutex> guard(mutex);
+                Task* task = injected_head;
+                if (task != nullptr) {
+                    injected_head = task->next;
+                    if (injected_head == nullptr) {
+                        injected_tail = nullptr;
+                    }
+                }
+                return task;
+            }
+
+            // Called after a deque push. The read-modify-write pairs with the
+            // increment in workerMain: either it sees the sleeper, or the
+            // sleeper sees the pushed task when it re-checks the deques. The
+            // notify takes the mutex so it cannot slip in between that
+            // re-check and cond.wait.
+            void wake() {
+                if (sleeping.fetch_add(0, std::memory_order_seq_cst) > 0) {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    cond.notify_one();
+                }
+            }
+
+            // Caller holds the mutex.
+            bool hasQueuedWork() const {
+                if (injected_head != nullptr) {
+                    return true;
+                }
+                for (usize i = 0; i < workers.len; i++) {
+                    const TaskDeque& deque = workers.ptr.raw_ptr[i].deque;
+                    if (deque.top.load(std::memory_order_acquire) < deque.bottom.load(std::memory_order_acquire)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            Task* findWork(Worker* worker) {
+                if (Task* task = worker->deque.pop()) {
+                    return task;
+                }
+
+                std::size_t count = workers.len;
+                worker->rng ^= worker->rng << 13;
+                worker->rng ^= worker->rng >> 7;
+                worker->rng ^= worker->rng << 17;
+                std::size_t start = worker->rng % count;
+                for (std::size_t i = 0; i < count; i++) {
+                    Worker* victim = &workers.ptr.raw_ptr[(start + i) % count];
+                    if (victim == worker) continue;
+                    if (Task* task = victim->deque.steal()) {
+                        return task;
+                    }
+                }
+
+                std::lock_guard<std::mutex> guard(mutex);
+                Task* task = injected_head;
+                if (task != nullptr) {
+                    injected_head = task->next;
+                    if (injected_head == nullptr) {
+                        injected_tail = nullptr;
+                    }
+                }
+                return task;
+            }
+
+            // Exits only once deinit was called and no queued work is left,
+            // so spawnWg closures are never dropped.
+            void workerMain(Worker* worker) {
+                current_worker = worker;
+                while (true) {
+                    if (Task* task = findWork(worker)) {
+                        task->run(task);
+                        continue;
+                    }
+
+                    std::unique_lock<std::mutex> lock(mutex);
+                    sleeping.fetch_add(1, std::memory_order_seq_cst);
+                    if (hasQueuedWork()) {
+                        sleeping.fetch_sub(1, std::memory_order_relaxed);
+                        continue;
+                    }
+                    if (!running.load(std::memory_order_relaxed)) {
+                        sleeping.fetch_sub(1, std::memory_order_relaxed);
+                        break;
+                    }
+                    cond.wait(lock);
+                    sleeping.fetch_sub(1, std::memory_order_relaxed);
+                }
+                current_worker = nullptr;
+            }
+        };
+
+        namespace parallel_impl {
+            template <typename T, typename F, typename E>
+            struct ForContext {
+                Pool* pool;
+                usize grain;
+                F* fn;
+                std::atomic<bool> failed;
+                E error;
+            };
+
+            template <typename T, typename F, typename E>
+            void forRange(ForContext<T, F, E>& ctx, Slice<T> items) {
+                if (ctx.failed.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                if (items.len <= ctx.grain) {
+                    E error = (*ctx.fn)(items);
+                    if (error.hasError() && !ctx.failed.exchange(true, std::memory_order_relaxed)) {
+                        ctx.error = error;
+                    }
+                    return;
+                }
+                usize mid = items.len / 2;
+                ctx.pool->join(
+                    [&] { forRange(ctx, items.slice(0, mid)); },
+                    [&] { forRange(ctx, items.slice(mid)); }
+                );
+            }
+
+            template <typename T, typename R, typename Map, typename Combine>
+            R reduceRange(Pool& pool, Slice<T> items, usize grain, Map& map, Combine& combine) {
+                if (items.len <= grain) {
+                    return map(items);
+                }
+                usize mid = items.len / 2;
+                R left;
+                R right;
+                pool.join(
+                    [&] { left = reduceRange<T, R>(pool, items.slice(0, mid), grain, map, combine); },
+                    [&] { right = reduceRange<T, R>(pool, items.slice(mid), grain, map, combine); }
+                );
+                if (left.hasAnyError()) return left;
+                if (right.hasAnyError()) return right;
+                return combine(left.value(), right.value());
+            }
+        }
+
+        // Call `fn(chunk)` on chunks of at most `grain` items in parallel.
+        // `fn` returns an Error<...>; once a chunk fails no new chunks are
+        // started and the first error recorded is returned.
+        template <typename T, typename F>
+        auto parallelFor(Pool& pool, Slice<T> items, usize grain, F fn) -> std::invoke_result_t<F&, Slice<T>> {
+            using E = std::invoke_result_t<F&, Slice<T>>;
+            if (grain == 0) [[unlikely]] {
+                PANIC("grain must be greater than zero");
+            }
+            parallel_impl::ForContext<T, F, E> ctx{&pool, grain, &fn, {false}, E()};
+            pool.run([&] { parallel_impl::forRange(ctx, items); });
+            return ctx.error;
+        }
+
+        // Reduce `items` by mapping chunks of at most `grain` items with
+        // `map(chunk) -> Result<R, ...>` and merging with `combine(R, R) -> R`.
+        // `identity` is returned for an empty slice.
+        template <typename T, typename V, typename Map, typename Combine>
+        auto parallelReduce(Pool& pool, Slice<T> items, usize grain, V identity, Map map, Combine combine)
+            -> std::invoke_result_t<Map&, Slice<T>>
+        {
+            using R = std::invoke_result_t<Map&, Slice<T>>;
+            if (grain == 0) [[unlikely]] {
+                PANIC("grain must be greater than zero");
+            }
+            if (items.len == 0) {
+                return R(identity);
+            }
+            R result;
+            pool.run([&] { result = parallel_impl::reduceRange<T, R>(pool, items, grain, map, combine); });
+            return result;
+        }
+    }
+}
+// ==== thread pool
+
+// queues ====
+namespace stj {
+    namespace thread {
+        enum class QueueError {
+            Full,
+            Empty,
+        };
+
+        // Bounded single-producer/single-consumer ring buffer. Each side
+        // keeps a cached copy of the other side's index on its own cache
+        // line and only reloads it when the ring looks full or empty.
+        template <typename T>
+        struct SpscQueue {
+            static_assert(std::is_trivially_copyable_v<T>, "SpscQueue items must be trivially copyable");
+
+            Slice<T> buffer = Slice<T>::empty();
+            std::size_t mask = 0;
+            char buffer_padding[cache_line];
+
+            // consumer side
+            std::atomic<std::size_t> head{0};
+            std::size_t cached_tail = 0;
+            char head_padding[cache_line];
+
+            // producer side
+            std::atomic<std::size_t> tail{0};
+            std::size_t cached_head = 0;
+            char tail_padding[cache_line];
+
+            // `capacity` must be a power of two.
+            void init(heap::Allocator allocator, usize capacity) {
+                if (capacity == 0 || (capacity & (capacity - 1)) != 0) [[unlikely]] {
+                    PANIC("queue capacity must be a power of two");
+                }
+                buffer = allocator.alloc<T>(capacity);
+                mask = capacity.raw() - 1;
+                head.store(0, std::memory_order_relaxed);
+                tail.store(0, std::memory_order_relaxed);
+                cached_head = 0;
+                cached_tail = 0;
+            }
+
+            void deinit(heap::Allocator allocator) {
+                allocator.free(buffer);
+            }
+
+            // Producer only.
+            Error<QueueError> push(const T& item) {
+                std::size_t t = tail.load(std::memory_order_relaxed);
+                if (t - cached_head > mask) {
+                    cached_head = head.load(std::memory_order_acquire);
+                    if (t - cached_head > mask) {
+                        return QueueError::Full;
+                    }
+                }
+                buffer.ptr.raw_ptr[t & mask] = item;
+                tail.store(t + 1, std::memory_order_release);
+                return {};
+            }
+
+            // Consumer only.
+            Result<T, QueueError> pop() {
+                std::size_t h = head.load(std::memory_order_relaxed);
+                if (h == cached_tail) {
+                    cached_tail = tail.load(std::memory_order_acquire);
+                    if (h == cached_tail) {
+                        return QueueError::Empty;
+                    }
+                }
+                T item = buffer.ptr.raw_ptr[h & mask];
+                head.store(h + 1, std::memory_order_release);
+                return item;
+            }
+
+            // Producer only. Pushes as many leading items as fit and returns
+            // how many, or Full when none fit.
+            Result<usize, QueueError> pushSlice(Slice<const T> items) {
+                if (items.len == 0) {
+                    return usize(0);
+                }
+                std::size_t t = tail.load(std::memory_order_relaxed);
+                std::size_t free = mask + 1 - (t - cached_head);
+                if (free < items.len) {
+                    cached_head = head.load(std::memory_order_acquire);
+                    free = mask + 1 - (t - cached_head);
+                }
+                std::size_t count = std::min<std::size_t>(free, items.len);
+                if (count == 0) {
+                    return QueueError::Full;
+                }
+                copyRing(t, items.ptr.raw_ptr, count, true);
+                tail.store(t + count, std::memory_order_release);
+                return usize(count);
+            }
+
+            // Consumer only. Pops up to `out.len` items into `out` and returns
+            // how many, or Empty when there were none.
+            Result<usize, QueueError> popSlice(Slice<T> out) {
+                if (out.len == 0) {
+                    return usize(0);
+                }
+                std::size_t h = head.load(std::memory_order_relaxed);
+                std::size_t available = cached_tail - h;
+                if (available < out.len) {
+                    cached_tail = tail.load(std::memory_order_acquire);
+                    available = cached_tail - h;
+                }
+                std::size_t count = std::min<std::size_t>(available, out.len);
+                if (count == 0) {
+                    return QueueError::Empty;
+                }
+                copyRing(h, out.ptr.raw_ptr, count, false);
+                head.store(h + count, std::memory_order_release);
+                return usize(count);
+            }
+
+        private:
+            void copyRing(std::size_t index, const T* in_or_out, std::size_t count, bool into_ring) {
+                std::size_t start = index & mask;
+                std::size_t first = std::min(count, mask + 1 - start);
+                T* ring = buffer.ptr.raw_ptr;
+                T* other = const_cast<T*>(in_or_out);
+                if (into_ring) {
+                    std::memcpy(ring + start, other, first * sizeof(T));
+                    std::memcpy(ring, other + first, (count - first) * sizeof(T));
+                } else {
+                    std::memcpy(other, ring + start, first * sizeof(T));
+                    std::memcpy(other + first, ring, (count - first) * sizeof(T));
+                }
+            }
+        };
+
+        // Bounded multi-producer/multi-consumer queue after Dmitry Vyukov:
+        // every slot has a sequence number telling which lap may use it next,
+        // so producers and consumers only contend on their own index.
+        template <typename T>
+        struct MpmcQueue {
+            static_assert(std::is_trivially_copyable_v<T>, "MpmcQueue items must be trivially copyable");
+
+            Slice<T> buffer = Slice<T>::empty();
+            Slice<std::atomic<std::size_t>> sequences = Slice<std::atomic<std::size_t>>::empty();
+            std::size_t mask = 0;
+            char buffer_padding[cache_line];
+
+            std::atomic<std::size_t> enqueue_pos{0};
+            char enqueue_padding[cache_line];
+
+            std::atomic<std::size_t> dequeue_pos{0};
+            char dequeue_padding[cache_line];
+
+            // `capacity` must be a power of two.
+            void init(heap::Allocator allocator, usize capacity) {
+                if (capacity == 0 || (capacity & (capacity - 1)) != 0) [[unlikely]] {
+                    PANIC("queue capacity must be a power of two");
+                }
+                buffer = allocator.alloc<T>(capacity);
+                sequences = allocator.alloc<std::atomic<std::size_t>>(capacity);
+                for (std::size_t i = 0; i < capacity; i++) {
+                    new (&sequences.ptr.raw_ptr[i]) std::atomic<std::size_t>(i);
+                }
+                mask = capacity.raw() - 1;
+                enqueue_pos.store(0, std::memory_order_relaxed);
+                dequeue_pos.store(0, std::memory_order_relaxed);
+            }
+
+            void deinit(heap::Allocator allocator) {
+                allocator.free(sequences);
+                allocator.free(buffer);
+            }
+
+            Error<QueueError> push(const T& item) {
+                Result<usize, QueueError> pushed = pushSlice(Slice<const T>{MiPtr<const T>(&item), 1});
+                if (pushed.hasAnyError()) {
+                    return QueueError::Full;
+                }
+                return {};
+            }
+
+            Result<T, QueueError> pop() {
+                std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+                while (true) {
+                    std::size_t index = pos & mask;
+                    std::size_t seq = sequences.ptr.raw_ptr[index].load(std::memory_order_acquire);
+                    std::ptrdiff_t lap = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+                    if (lap < 0) {
+                        return QueueError::Empty;
+                    }
+                    if (lap > 0) {
+                        pos = dequeue_pos.load(std::memory_order_relaxed);
+                        continue;
+                    }
+                    if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        T item = buffer.ptr.raw_ptr[index];
+                        sequences.ptr.raw_ptr[index].store(pos + mask + 1, std::memory_order_release);
+                        return item;
+                    }
+                }
+            }
+
+            // Claims a run of consecutive free slots with a single CAS and
+            // returns how many leading items were pushed, or Full when none.
+            Result<usize, QueueError> pushSlice(Slice<const T> items) {
+                if (items.len == 0) {
+                    return usize(0);
+                }
+                std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+                std::size_t count;
+                while (true) {
+                    count = 0;
+                    while (count < items.len && count <= mask) {
+                        std::size_t seq = sequences.ptr.raw_ptr[(pos + count) & mask].load(std::memory_order_acquire);
+                        if (seq != pos + count) break;
+                        count++;
+                    }
+                    if (count == 0) {
+                        std::size_t seq = sequences.ptr.raw_ptr[pos & mask].load(std::memory_order_acquire);
+                        if (static_cast<std::ptrdiff_t>(seq - pos) < 0) {
+                            return QueueError::Full;
+                        }
+                        pos = enqueue_pos.load(std::memory_order_relaxed);
+                        continue;
+                    }
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                for (std::size_t i = 0; i < count; i++) {
+                    std::size_t index = (pos + i) & mask;
+                    buffer.ptr.raw_ptr[index] = items.ptr.raw_ptr[i];
+                    sequences.ptr.raw_ptr[index].store(pos + i + 1, std::memory_order_release);
+                }
+                return usize(count);
+            }
+
+            // Claims a run of consecutive filled slots with a single CAS and
+            // returns how many items were popped into `out`, or Empty when none.
+            Result<usize, QueueError> popSlice(Slice<T> out) {
+                if (out.len == 0) {
+                    return usize(0);
+                }
+                std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+                std::size_t count;
+                while (true) {
+                    count = 0;
+                    while (count < out.len && count <= mask) {
+                        std::size_t seq = sequences.ptr.raw_ptr[(pos + count) & mask].load(std::memory_order_acquire);
+                        if (seq != pos + count + 1) break;
+                        count++;
+                    }
+                    if (count == 0) {
+                        std::size_t seq = sequences.ptr.raw_ptr[pos & mask].load(std::memory_order_acquire);
+                        if (static_cast<std::ptrdiff_t>(seq - (pos + 1)) < 0) {
+                            return QueueError::Empty;
+                        }
+                        pos = dequeue_pos.load(std::memory_order_relaxed);
+                        continue;
+                    }
+                    if (dequeue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                for (std::size_t i = 0; i < count; i++) {
+                    std::size_t index = (pos + i) & mask;
+                    out.ptr.raw_ptr[i] = buffer.ptr.raw_ptr[index];
+                    sequences.ptr.raw_ptr[index].store(pos + i + mask + 1, std::memory_order_release);
+                }
+                return usize(count);
+            }
+        };
+    }
+}
+// ==== queues
+
+// atomic ints ====
+namespace stj {
+    namespace thread {
+        enum class OverflowError {
+            Overflow,
+        };
+
+        // Shared integer with SafeInt's checked arithmetic.
+        // fetchAdd/fetchSub use a single locked add and panic if the old value
+        // shows it overflowed, like SafeInt operators, though other threads
+        // may see the wrapped value before the panic lands. The try variants
+        // use a CAS loop that never stores an overflowed value and return
+        // Overflow instead, at the cost of retries under contention.
+        template <typename T>
+        struct AtomicInt {
+            static_assert(std::is_integral_v<T>, "AtomicInt can only wrap integral types");
+
+            std::atomic<T> value;
+
+            constexpr AtomicInt() : value(0) {}
+            constexpr AtomicInt(SafeInt<T> initial) : value(initial.raw()) {}
+
+            SafeInt<T> load(std::memory_order order = std::memory_order_seq_cst) const {
+                return value.load(order);
+            }
+
+            void store(SafeInt<T> new_value, std::memory_order order = std::memory_order_seq_cst) {
+                value.store(new_value.raw(), order);
+            }
+
+            // Returns the previous value.
+            SafeInt<T> fetchAdd(SafeInt<T> delta, std::memory_order order = std::memory_order_seq_cst) {
+                T old = value.fetch_add(delta.raw(), order);
+                T result;
+                if (__builtin_add_overflow(old, delta.raw(), &result)) [[unlikely]] {
+                    PANIC("Integer overflow in atomic addition");
+                }
+                return old;
+            }
+
+            SafeInt<T> fetchSub(SafeInt<T> delta, std::memory_order order = std::memory_order_seq_cst) {
+                T old = value.fetch_sub(delta.raw(), order);
+                T result;
+                if (__builtin_sub_overflow(old, delta.raw(), &result)) [[unlikely]] {
+                    PANIC("Integer underflow in atomic subtraction");
+                }
+                return old;
+            }
+
+            // Returns the previous value, or Overflow with the value unchanged.
+            Result<SafeInt<T>, OverflowError> tryFetchAdd(SafeInt<T> delta, std::memory_order order = std::memory_order_seq_cst) {
+                T old = value.load(std::memory_order_relaxed);
+                T result;
+                do {
+                    if (__builtin_add_overflow(old, delta.raw(), &result)) [[unlikely]] {
+                        return OverflowError::Overflow;
+                    }
+                } while (!value.compare_exchange_weak(old, result, order, std::memory_order_relaxed));
+                return SafeInt<T>(old);
+            }
+
+            Result<SafeInt<T>, OverflowError> tryFetchSub(SafeInt<T> delta, std::memory_order order = std::memory_order_seq_cst) {
+                T old = value.load(std::memory_order_relaxed);
+                T result;
+                do {
+                    if (__builtin_sub_overflow(old, delta.raw(), &result)) [[unlikely]] {
+                        return OverflowError::Overflow;
+                    }
+                } while (!value.compare_exchange_weak(old, result, order, std::memory_order_relaxed));
+                return SafeInt<T>(old);
+            }
+        };
+
+        namespace counter_impl {
+            // Threads are numbered on first use, so consecutive threads land
+            // on different shards of every counter.
+            inline std::size_t threadSlot() {
+                static std::atomic<std::size_t> next{0};
+                static thread_local std::size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+                return slot;
+            }
+        }
+
+        // Counter for hot paths that many threads bump at once. Each thread
+        // adds to its own cache line with a relaxed atomic and read() sums the
+        // shards, so writers never contend but a read costs one load per
+        // shard and is not a snapshot taken at a single point in time.
+        // Every shard update and the sum are overflow checked.
+        template <typename T>
+        struct ShardedCounter {
+            static_assert(std::is_integral_v<T>, "ShardedCounter can only count integral types");
+
+            struct Shard {
+                AtomicInt<T> value;
+                char padding[cache_line - sizeof(AtomicInt<T>)];
+            };
+
+            Slice<Shard> shards = Slice<Shard>::empty();
+            std::size_t mask = 0;
+
+            // `shard_count` must be a power of two, usually the thread count
+            // rounded up.
+            void init(heap::Allocator allocator, usize shard_count) {
+                if (shard_count == 0 || (shard_count & (shard_count - 1)) != 0) [[unlikely]] {
+                    PANIC("shard count must be a power of two");
+                }
+                shards = allocator.alloc<Shard>(shard_count);
+                for (usize i = 0; i < shard_count; i++) {
+                    new (&shards.ptr.raw_ptr[i]) Shard{};
+                }
+                mask = shard_count.raw() - 1;
+            }
+
+            void deinit(heap::Allocator allocator) {
+                allocator.free(shards);
+            }
+
+            void add(SafeInt<T> delta) {
+                shards.ptr.raw_ptr[counter_impl::threadSlot() & mask].value.fetchAdd(delta, std::memory_order_relaxed);
+            }
+
+            // Only for signed counters, a shard of an unsigned counter would
+            // underflow when another thread did the matching add.
+            void sub(SafeInt<T> delta) {
+                static_assert(std::is_signed_v<T>, "ShardedCounter::sub needs a signed counter");
+                shards.ptr.raw_ptr[counter_impl::threadSlot() & mask].value.fetchSub(delta, std::memory_order_relaxed);
+            }
+
+            SafeInt<T> read() const {
+                SafeInt<T> total = 0;
+                for (std::size_t i = 0; i <= mask; i++) {
+                    total = total + shards.ptr.raw_ptr[i].value.load(std::memory_order_relaxed);
+                }
+                return total;
+            }
+
+            void reset() {
+                for (std::size_t i = 0; i <= mask; i++) {
+                    shards.ptr.raw_ptr[i].value.store(0, std::memory_order_relaxed);
+                }
+            }
+        };
+    }
+}
+// ==== atomic ints
+
+// sort ====
+// Sorting and searching over Slice<T>. The slice is validated once on entry,
+// the inner loops then work on raw pointers. `less(a, b)` must be a strict
+// weak ordering and defaults to operator<.
+namespace stj {
+    namespace sort {
+        enum class SearchError {
+            NotFound,
+        };
+
+        namespace sort_impl {
+            constexpr std::size_t insertion_threshold = 24;
+            constexpr std::size_t ninther_threshold = 128;
+            constexpr std::size_t partial_insertion_limit = 8;
+            constexpr std::size_t block_partition_size = 64;
+            constexpr std::size_t merge_block_size = 20;
+            constexpr std::size_t parallel_threshold = 1 << 14;
+
+            // Block partitioning trades branches for extra moves, which only
+            // pays off when elements are cheap to copy.
+            template <typename T>
+            constexpr bool branchless_v = std::is_trivially_copyable_v<T> && sizeof(T) <= 2 * sizeof(void*);
+
+            inline std::size_t log2(std::size_t n) {
+                std::size_t log = 0;
+                while (n >>= 1) log++;
+                return log;
+            }
+
+            template <typename T, typename Less>
+            void insertionSort(T* begin, T* end, Less& less) {
+                if (begin == end) return;
+                for (T* cur = begin + 1; cur != end; cur++) {
+                    T* sift = cur;
+                    T* sift_1 = cur - 1;
+                    if (less(*sift, *sift_1)) {
+                        T tmp = std::move(*sift);
+                        do {
+                            *sift-- = std::move(*sift_1);
+                        } while (sift != begin && less(tmp, *--sift_1));
+                        *sift = std::move(tmp);
+                    }
+                }
+            }
+
+            // Requires an element before `begin` that is not greater than any
+            // element of the range, so the sift loop needs no bound check.
+            template <typename T, typename Less>
+            void unguardedInsertionSort(T* begin, T* end, Less& less) {
+                if (begin == end) return;
+                for (T* cur = begin + 1; cur != end; cur++) {
+                    T* sift = cur;
+                    T* sift_1 = cur - 1;
+                    if (less(*sift, *sift_1)) {
+                        T tmp = std::move(*sift);
+                        do {
+                            *sift-- = std::move(*sift_1);
+                        } while (less(tmp, *--sift_1));
+                        *sift = std::move(tmp);
+                    }
+                }
+            }
+
+            // Insertion sort that gives up after moving `partial_insertion_limit`
+            // elements. Returns whether the range ended up sorted.
+            template <typename T, typename Less>
+            bool partialInsertionSort(T* begin, T* end, Less& less) {
+                if (begin == end) return true;
+                std::size_t moved = 0;
+                for (T* cur = begin + 1; cur != end; cur++) {
+                    if (moved > partial_insertion_limit) return false;
+                    T* sift = cur;
+                    T* sift_1 = cur - 1;
+                    if (less(*sift, *sift_1)) {
+                        T tmp = std::move(*sift);
+                        do {
+                            *sift-- = std::move(*sift_1);
+                        } while (sift != begin && less(tmp, *--sift_1));
+                        *sift = std::move(tmp);
+                        moved += cur - sift;
+                    }
+                }
+                return true;
+            }
+
+            template <typename T, typename Less>
+            void sort2(T* a, T* b, Less& less) {
+                if (less(*b, *a)) std::swap(*a, *b);
+            }
+
+            template <typename T, typename Less>
+            void sort3(T* a, T* b, T* c, Less& less) {
+                sort2(a, b, less);
+                sort2(b, c, less);
+                sort2(a, b, less);
+            }
+
+            // Moves the median of a sample of the range to `begin`.
+            template <typename T, typename Less>
+            void choosePivot(T* begin, T* end, Less& less) {
+                std::size_t size = end - begin;
+                std::size_t s2 = size / 2;
+                if (size > ninther_threshold) {
+                    sort3(begin, begin + s2, end - 1, less);
+                    sort3(begin + 1, begin + (s2 - 1), end - 2, less);
+                    sort3(begin + 2, begin + (s2 + 1), end - 3, less);
+                    sort3(begin + (s2 - 1), begin + s2, begin + (s2 + 1), less);
+                    std::swap(*begin, *(begin + s2));
+                } else {
+                    sort3(begin + s2, begin, end - 1, less);
+                }
+            }
+
+            template <typename T>
+            struct Partition {
+                T* pivot;
+                bool already_partitioned;
+            };
+
+            // Partitions around the pivot at `begin`, elements equal to the
+            // pivot go to the right.
+            template <typename T, typename Less>
+            Partition<T> partitionRight(T* begin, T* end, Less& less) {
+                T pivot = std::move(*begin);
+                T* first = begin;
+                T* last = end;
+
+                while (less(*++first, pivot));
+                if (first - 1 == begin) {
+                    while (first < last && !less(*--last, pivot));
+                } else {
+                    while (!less(*--last, pivot));
+                }
+
+                bool already_partitioned = first >= last;
+                while (first < last) {
+                    std::swap(*first, *last);
+                    while (less(*++first, pivot));
+                    while (!less(*--last, pivot));
+                }
+
+                T* pivot_pos = first - 1;
+                *begin = std::move(*pivot_pos);
+                *pivot_pos = std::move(pivot);
+                return {pivot_pos, already_partitioned};
+            }
+
+            template <typename T>
+            void swapOffsets(T* first, T* last, const unsigned char* offsets_l, const unsigned char* offsets_r,
+                             std::size_t num, bool use_swaps) {
+                if (use_swaps) {
+                    // Needed when num_l == num_r so every element ends up on the right side.
+                    for (std::size_t i = 0; i < num; i++) {
+                        std::swap(*(first + offsets_l[i]), *(last - offsets_r[i]));
+                    }
+                } else if (num > 0) {
+                    T* l = first + offsets_l[0];
+                    T* r = last - offsets_r[0];
+                    T tmp(std::move(*l));
+                    *l = std::move(*r);
+                    for (std::size_t i = 1; i < num; i++) {
+                        l = first + offsets_l[i];
+                        *r = std::move(*l);
+                        r = last - offsets_r[i];
+                        *l = std::move(*r);
+                    }
+                    *r = std::move(tmp);
+                }
+            }
+
+            // partitionRight without data-dependent branches: comparison
+            // results are collected into offset buffers and swapped in blocks.
+            template <typename T, typename Less>
+            Partition<T> partitionRightBranchless(T* begin, T* end, Less& less) {
+                T pivot = std::move(*begin);
+                T* first = begin;
+                T* last = end;
+
+                while (less(*++first, pivot));
+                if (first - 1 == begin) {
+                    while (first < last && !less(*--last, pivot));
+                } else {
+                    while (!less(*--last, pivot));
+                }
+
+                bool already_partitioned = first >= last;
+                if (!already_partitioned) {
+                    std::swap(*first, *last);
+                    first++;
+
+                    alignas(cache_line) unsigned char offsets_l[block_partition_size];
+                    alignas(cache_line) unsigned char offsets_r[block_partition_size];
+
+                    T* offsets_l_base = first;
+                    T* offsets_r_base = last;
+                    std::size_t num_l = 0;
+                    std::size_t num_r = 0;
+                    std::size_t start_l = 0;
+                    std::size_t start_r = 0;
+
+                    while (first < last) {
+                        std::size_t num_unknown = last - first;
+                        std::size_t left_split = num_l == 0 ? (num_r == 0 ? num_unknown / 2 : num_unknown) : 0;
+                        std::size_t right_split = num_r == 0 ? (num_unknown - left_split) : 0;
+
+                        if (left_split > block_partition_size) left_split = block_partition_size;
+                        for (std::size_t i = 0; i < left_split;) {
+                            offsets_l[num_l] = static_cast<unsigned char>(i++);
+                            num_l += !less(*first, pivot);
+                            first++;
+                        }
+
+                        if (right_split > block_partition_size) right_split = block_partition_size;
+                        for (std::size_t i = 0; i < right_split;) {
+                            offsets_r[num_r] = static_cast<unsigned char>(++i);
+                            num_r += less(*--last, pivot);
+                        }
+
+                        std::size_t num = std::min(num_l, num_r);
+                        swapOffsets(offsets_l_base, offsets_r_base, offsets_l + start_l, offsets_r + start_r,
+                                    num, num_l == num_r);
+                        num_l -= num;
+                        num_r -= num;
+                        start_l += num;
+                        start_r += num;
+                        if (num_l == 0) {
+                            start_l = 0;
+                            offsets_l_base = first;
+                        }
+                        if (num_r == 0) {
+                            start_r = 0;
+                            offsets_r_base = last;
+                        }
+                    }
+
+                    // At most one side still has unplaced elements.
+                    if (num_l) {
+                        while (num_l--) std::swap(*(offsets_l_base + offsets_l[start_l + num_l]), *--last);
+                        first = last;
+                    }
+                    if (num_r) {
+                        while (num_r--) std::swap(*(offsets_r_base - offsets_r[start_r + num_r]), *first++);
+                        last = first;
+                    }
+                }
+
+                T* pivot_pos = first - 1;
+                *begin = std::move(*pivot_pos);
+                *pivot_pos = std::move(pivot);
+                return {pivot_pos, already_partitioned};
+            }
+
+            // Partitions around the pivot at `begin`, elements equal to the
+            // pivot go to the left. Used when the pivot equals its predecessor
+            // to skip runs of equal elements in one step.
+            template <typename T, typename Less>
+            T* partitionLeft(T* begin, T* end, Less& less) {
+                T pivot = std::move(*begin);
+                T* first = begin;
+                T* last = end;
+
+                while (less(pivot, *--last));
+                if (last + 1 == end) {
+                    while (first < last && !less(pivot, *++first));
+                } else {
+                    while (!less(pivot, *++first));
+                }
+
+                while (first < last) {
+                    std::swap(*first, *last);
+                    while (less(pivot, *--last));
+                    while (!less(pivot, *++first));
+                }
+
+                T* pivot_pos = last;
+                *begin = std::move(*pivot_pos);
+                *pivot_pos = std::move(pivot);
+                return pivot_pos;
+            }
+
+            template <typename T, typename Less>
+            void heapSort(T* begin, T* end, Less& less) {
+                std::make_heap(begin, end, less);
+                std::sort_heap(begin, end, less);
+            }
+
+            // Scrambles a few elements after a bad partition so adversarial
+            // patterns cannot keep producing bad pivots.
+            template <typename T>
+            void breakPatterns(T* begin, T* pivot_pos, T* end) {
+                std::size_t l_size = pivot_pos - begin;
+                std::size_t r_size = end - (pivot_pos + 1);
+                if (l_size >= insertion_threshold) {
+                    std::swap(*begin, *(begin + l_size / 4));
+                    std::swap(*(pivot_pos - 1), *(pivot_pos - l_size / 4));
+                    if (l_size > ninther_threshold) {
+                        std::swap(*(begin + 1), *(begin + (l_size / 4 + 1)));
+                        std::swap(*(begin + 2), *(begin + (l_size / 4 + 2)));
+                        std::swap(*(pivot_pos - 2), *(pivot_pos - (l_size / 4 + 1)));
+                        std::swap(*(pivot_pos - 3), *(pivot_pos - (l_size / 4 + 2)));
+                    }
+                }
+                if (r_size >= insertion_threshold) {
+                    std::swap(*(pivot_pos + 1), *(pivot_pos + (1 + r_size / 4)));
+                    std::swap(*(end - 1), *(end - r_size / 4));
+                    if (r_size > ninther_threshold) {
+                        std::swap(*(pivot_pos + 2), *(pivot_pos + (2 + r_size / 4)));
+                        std::swap(*(pivot_pos + 3), *(pivot_pos + (3 + r_size / 4)));
+                        std::swap(*(end - 2), *(end - (1 + r_size / 4)));
+                        std::swap(*(end - 3), *(end - (2 + r_size / 4)));
+                    }
+                }
+            }
+
+            template <typename T, typename Less>
+            void pdqLoop(T* begin, T* end, Less& less, std::size_t bad_allowed, bool leftmost) {
+                while (true) {
+                    std::size_t size = end - begin;
+                    if (size < insertion_threshold) {
+                        if (leftmost) {
+                            insertionSort(begin, end, less);
+                        } else {
+                            unguardedInsertionSort(begin, end, less);
+                        }
+                        return;
+                    }
+
+                    choosePivot(begin, end, less);
+
+                    if (!leftmost && !less(*(begin - 1), *begin)) {
+                        begin = partitionLeft(begin, end, less) + 1;
+                        continue;
+                    }
+
+                    Partition<T> part;
+                    if constexpr (branchless_v<T>) {
+                        part = partitionRightBranchless(begin, end, less);
+                    } else {
+                        part = partitionRight(begin, end, less);
+                    }
+                    T* pivot_pos = part.pivot;
+
+                    std::size_t l_size = pivot_pos - begin;
+                    std::size_t r_size = end - (pivot_pos + 1);
+                    if (l_size < size / 8 || r_size < size / 8) {
+                        if (--bad_allowed == 0) {
+                            heapSort(begin, end, less);
+                            return;
+                        }
+                        breakPatterns(begin, pivot_pos, end);
+                    } else if (part.already_partitioned
+                        && partialInsertionSort(begin, pivot_pos, less)
+                        && partialInsertionSort(pivot_pos + 1, end, less)) {
+                        return;
+                    }
+
+                    pdqLoop(begin, pivot_pos, less, bad_allowed, leftmost);
+                    begin = pivot_pos + 1;
+                    leftmost = false;
+                }
+            }
+
+            // Binary search for the first element in [first, last) for which
+            // `pred` is false, `pred` must be true for a prefix of the range.
+            template <typename T, typename Pred>
+            T* partitionPoint(T* first, T* last, Pred pred) {
+                std::size_t n = last - first;
+                while (n > 0) {
+                    std::size_t half = n / 2;
+                    if (pred(first[half])) {
+                        first += half + 1;
+                        n -= half + 1;
+                    } else {
+                        n = half;
+                    }
+                }
+                return first;
+            }
+
+            // Stable in-place merge of [a, m) and [m, b) by rotations
+            // (SymMerge, Kim & Kutzner).
+            template <typename T, typename Less>
+            void symMerge(T* a, T* m, T* b, Less& less) {
+                if (m - a == 1) {
+                    T* i = partitionPoint(m, b, [&](const T& x) { return less(x, *a); });
+                    std::rotate(a, a + 1, i);
+                    return;
+                }
+                if (b - m == 1) {
+                    T* i = partitionPoint(a, m, [&](const T& x) { return !less(*m, x); });
+                    std::rotate(i, m, b);
+                    return;
+                }
+
+                std::ptrdiff_t mid = (b - a) / 2;
+                std::ptrdiff_t n = mid + (m - a);
+                std::ptrdiff_t start;
+                std::ptrdiff_t r;
+                if (m - a > mid) {
+                    start = n - (b - a);
+                    r = mid;
+                } else {
+                    start = 0;
+                    r = m - a;
+                }
+                std::ptrdiff_t p = n - 1;
+                while (start < r) {
+                    std::ptrdiff_t c = start + (r - start) / 2;
+                    if (!less(a[p - c], a[c])) {
+                        start = c + 1;
+                    } else {
+                        r = c;
+                    }
+                }
+
+                std::ptrdiff_t end = n - start;
+                if (start < m - a && m - a < end) {
+                    std::rotate(a + start, m, a + end);
+                }
+                if (0 < start && start < mid) {
+                    symMerge(a, a + start, a + mid, less);
+                }
+                if (mid < end && end < b - a) {
+                    symMerge(a + mid, a + end, b, less);
+                }
+            }
+
+            // Stable merge of [a, m) and [m, b) that moves the left run into
+            // `scratch` (uninitialized, at least m - a items) first.
+            template <typename T, typename Less>
+            void bufferMerge(T* a, T* m, T* b, T* scratch, Less& less) {
+                std::size_t left_len = m - a;
+                std::uninitialized_move(a, m, scratch);
+                T* l = scratch;
+                T* l_end = scratch + left_len;
+                T* r = m;
+                T* out = a;
+                while (l < l_end && r < b) {
+                    if (less(*r, *l)) {
+                        *out++ = std::move(*r++);
+                    } else {
+                        *out++ = std::move(*l++);
+                    }
+                }
+                std::move(l, l_end, out);
+                std::destroy(scratch, l_end);
+            }
+
+            // Bottom-up merge sort over insertion-sorted blocks. Merges use
+            // `scratch` when given and SymMerge rotations otherwise.
+            template <typename T, typename Less>
+            void blockSort(T* items, std::size_t n, T* scratch, Less& less) {
+                std::size_t block = merge_block_size;
+                std::size_t a = 0;
+                for (; a + block <= n; a += block) {
+                    insertionSort(items + a, items + a + block, less);
+                }
+                insertionSort(items + a, items + n, less);
+
+                for (; block < n; block *= 2) {
+                    for (a = 0; a + block < n; a += 2 * block) {
+                        T* m = items + a + block;
+                        T* b = items + std::min(a + 2 * block, n);
+                        // Adjacent runs that are already in order need no merge.
+                        if (!less(*m, *(m - 1))) continue;
+                        if (scratch != nullptr) {
+                            bufferMerge(items + a, m, b, scratch, less);
+                        } else {
+                            symMerge(items + a, m, b, less);
+                        }
+                    }
+                }
+            }
+
+            template <typename T, typename = void>
+            struct RadixRaw {
+                using type = T;
+            };
+
+            template <typename T>
+            struct RadixRaw<T, std::enable_if_t<!std::is_integral_v<T>>> {
+                using type = decltype(std::declval<const T&>().raw());
+            };
+
+            // Maps the key to an unsigned integer with the same ordering.
+            template <typename T>
+            auto radixKey(const T& item) {
+                using Raw = typename RadixRaw<T>::type;
+                using Key = std::make_unsigned_t<Raw>;
+                Raw raw;
+                if constexpr (std::is_integral_v<T>) {
+                    raw = item;
+                } else {
+                    raw = item.raw();
+                }
+                Key key = static_cast<Key>(raw);
+                if constexpr (std::is_signed_v<Raw>) {
+                    key ^= Key(1) << (sizeof(Key) * 8 - 1);
+                }
+                return key;
+            }
+
+            template <typename T, typename Less>
+            void parallelSort(thread::Pool& pool, T* begin, T* end, Less& less, std::size_t depth) {
+                std::size_t size = end - begin;
+                if (size <= parallel_threshold || depth == 0) {
+                    pdqLoop(begin, end, less, log2(size), true);
+                    return;
+                }
+                choosePivot(begin, end, less);
+                Partition<T> part;
+                if constexpr (branchless_v<T>) {
+                    part = partitionRightBranchless(begin, end, less);
+                } else {
+                    part = partitionRight(begin, end, less);
+                }
+                T* pivot_pos = part.pivot;
+                pool.join(
+                    [&] { parallelSort(pool, begin, pivot_pos, less, depth - 1); },
+                    [&] { parallelSort(pool, pivot_pos + 1, end, less, depth - 1); }
+                );
+            }
+        }
+
+        // Pattern-defeating quicksort (Orson Peters). Unstable, in place,
+        // O(n log n) worst case and linear on sorted or reverse-sorted input.
+        template <typename T, typename Less = std::less<>>
+        void pdq(Slice<T> items, Less less = {}) {
+            T* begin = items.ptr.raw_ptr;
+            std::size_t n = items.len.raw();
+            if (n < 2) return;
+            sort_impl::pdqLoop(begin, begin + n, less, sort_impl::log2(n), true);
+        }
+
+        // Stable block merge sort without extra memory, merges are done in
+        // place by rotation which makes it O(n log^2 n) moves.
+        template <typename T, typename Less = std::less<>,
+                  typename = std::enable_if_t<!heap::is_allocator_v<std::remove_const_t<Less>>>>
+        void block(Slice<T> items, Less less = {}) {
+            sort_impl::blockSort<T>(items.ptr.raw_ptr, items.len.raw(), nullptr, less);
+        }
+
+        // Stable block merge sort that borrows `items.len` scratch items from
+        // `allocator` for O(n log n) merges.
+        template <typename T, typename A, typename Less = std::less<>,
+                  typename = std::enable_if_t<heap::is_allocator_v<std::remove_const_t<A>>>>
+        void block(Slice<T> items, A& allocator, Less less = {}) {
+            if (items.len < 2) return;
+            Slice<T> scratch = heap::typed::alloc<T>(allocator, items.len);
+            sort_impl::blockSort<T>(items.ptr.raw_ptr, items.len.raw(), scratch.ptr.raw_ptr, less);
+            heap::typed::free(allocator, scratch);
+        }
+
+        // LSD radix sort on 8-bit digits for integer keys (builtin integers or
+        // SafeInt/WrapInt/SatInt). Stable, needs `items.len` scratch items.
+        // Digits that are the same for every key are skipped.
+        template <typename T, typename A>
+        void radix(Slice<T> items, A& allocator) {
+            static_assert(std::is_trivially_copyable_v<T>, "radix sort needs trivially copyable keys");
+            using Key = decltype(sort_impl::radixKey(std::declval<const T&>()));
+            constexpr std::size_t digits = sizeof(Key);
+
+            std::size_t n = items.len.raw();
+            if (n < 2) return;
+
+            std::size_t counts[digits][256] = {};
+            T* src = items.ptr.raw_ptr;
+            for (std::size_t i = 0; i < n; i++) {
+                Key key = sort_impl::radixKey(src[i]);
+                for (std::size_t d = 0; d < digits; d++) {
+                    counts[d][(key >> (d * 8)) & 0xff]++;
+                }
+            }
+
+            Slice<T> scratch = heap::typed::alloc<T>(allocator, items.len);
+            T* dst = scratch.ptr.raw_ptr;
+            for (std::size_t d = 0; d < digits; d++) {
+                Key first_key = sort_impl::radixKey(src[0]);
+                if (counts[d][(first_key >> (d * 8)) & 0xff] == n) continue;
+
+                T* buckets[256];
+                T* out = dst;
+                for (std::size_t b = 0; b < 256; b++) {
+                    buckets[b] = out;
+                    out += counts[d][b];
+                }
+                for (std::size_t i = 0; i < n; i++) {
+                    std::size_t bucket = (sort_impl::radixKey(src[i]) >> (d * 8)) & 0xff;
+                    *buckets[bucket]++ = src[i];
+                }
+                std::swap(src, dst);
+            }
+            if (src != items.ptr.raw_ptr) {
+                std::memcpy(items.ptr.raw_ptr, src, n * sizeof(T));
+            }
+            heap::typed::free(allocator, scratch);
+        }
+
+        // Unstable parallel sort: partitions are split across `pool` with
+        // join until they are small enough to finish with pdq on one worker.
+        template <typename T, typename Less = std::less<>>
+        void parallel(thread::Pool& pool, Slice<T> items, Less less = {}) {
+            T* begin = items.ptr.raw_ptr;
+            std::size_t n = items.len.raw();
+            if (n < 2) return;
+            std::size_t depth = 2 * sort_impl::log2(n);
+            pool.run([&] { sort_impl::parallelSort(pool, begin, begin + n, less, depth); });
+        }
+
+        // Index of the first item that is not less than `key`. The loop has
+        // a fixed trip count and compiles to conditional moves.
+        template <typename T, typename K, typename Less = std::less<>>
+        usize lowerBound(Slice<const T> items, const K& key, Less less = {}) {
+            const T* base = items.ptr.raw_ptr;
+            std::size_t n = items.len.raw();
+            if (n == 0) return 0;
+            while (n > 1) {
+                std::size_t half = n / 2;
+                base = less(base[half - 1], key) ? base + half : base;
+                n -= half;
+            }
+            return usize(static_cast<std::size_t>(base - items.ptr.raw_ptr) + less(*base, key));
+        }
+
+        template <typename T, typename K, typename Less = std::less<>>
+        usize lowerBound(Slice<T> items, const K& key, Less less = {}) {
+            return lowerBound<T>(Slice<const T>(items), key, less);
+        }
+
+        // Index of an item equal to `key` in sorted `items`.
+        template <typename T, typename K, typename Less = std::less<>>
+        Result<usize, SearchError> binarySearch(Slice<const T> items, const K& key, Less less = {}) {
+            usize index = lowerBound<T>(items, key, less);
+            if (index == items.len || less(key, items.ptr.raw_ptr[index.raw()])) {
+                return SearchError::NotFound;
+            }
+            return index;
+        }
+
+        template <typename T, typename K, typename Less = std::less<>>
+        Result<usize, SearchError> binarySearch(Slice<T> items, const K& key, Less less = {}) {
+            return binarySearch<T>(Slice<const T>(items), key, less);
+        }
+    }
+}
+// ==== sort
+
+// hash ====
+// Non-cryptographic hashing for hash containers, sharding and dedup. Not
+// suitable for anything that must resist an attacker choosing the keys.
+namespace stj {
+    namespace hash {
+        // Wyhash (final v4), streaming. Produces the same values as
+        // std.hash.Wyhash in Zig for the same seed and input.
+        struct Wyhash {
+            static constexpr u64 secret[4] = {
+                0xa0761d6478bd642full,
+                0xe7037ed1a0b428dbull,
+                0x8ebc6af09c88c6e3ull,
+                0x589965cc75374cc3ull,
+            };
+
+            std::uint64_t a = 0;
+            std::uint64_t b = 0;
+            std::uint64_t state[3] = {};
+            std::uint64_t total_len = 0;
+            u8 buf[48] = {};
+            std::size_t buf_len = 0;
+
+            static Wyhash init(u64 seed) {
+                Wyhash self;
+                std::uint64_t s = seed.raw();
+                self.state[0] = s ^ mix(s ^ secret[0].raw(), secret[1].raw());
+                self.state[1] = self.state[0];
+                self.state[2] = self.state[0];
+                return self;
+            }
+
+            void update(Slice<const u8> input) {
+                const std::uint8_t* bytes = reinterpret_cast<const std::uint8_t*>(input.ptr.raw_ptr);
+                std::size_t len = input.len.raw();
+                if (len == 0) {
+                    return;
+                }
+                std::uint8_t* buffer = reinterpret_cast<std::uint8_t*>(buf);
+                total_len += len;
+
+                if (len <= 48 - buf_len) {
+                    std::memcpy(buffer + buf_len, bytes, len);
+                    buf_len += len;
+                    return;
+                }
+
+                std::size_t i = 0;
+                if (buf_len > 0) {
+                    i = 48 - buf_len;
+                    std::memcpy(buffer + buf_len, bytes, i);
+                    round(buffer);
+                    buf_len = 0;
+                }
+                for (; i + 48 < len; i += 48) {
+                    round(bytes + i);
+                }
+
+                // Keep the 16 bytes before a short tail, final1 reads behind it.
+                std::size_t remaining = len - i;
+                if (remaining < 16 && i >= 48) {
+                    std::size_t rem = 16 - remaining;
+                    std::memcpy(buffer + 48 - rem, bytes + i - rem, rem);
+                }
+                std::memcpy(buffer, bytes + i, remaining);
+                buf_len = remaining;
+            }
+
+            // Does not modify the hasher, more input can follow.
+            u64 final() const {
+                Wyhash self = *this;
+                const std::uint8_t* buffer = reinterpret_cast<const std::uint8_t*>(buf);
+                if (total_len <= 16) {
+                    self.smallKey(buffer, buf_len);
+                } else {
+                    std::uint8_t scratch[16];
+                    const std::uint8_t* input = buffer;
+                    std::size_t input_len = buf_len;
+                    std::size_t offset = 0;
+                    if (buf_len < 16) {
+                        std::size_t rem = 16 - buf_len;
+                        std::memcpy(scratch, buffer + 48 - rem, rem);
+                        std::memcpy(scratch + rem, buffer, buf_len);
+                        input = scratch;
+                        input_len = 16;
+                        offset = rem;
+                    }
+                    self.final0();
+                    self.final1(input, input_len, offset);
+                }
+                return self.final2();
+            }
+
+            static u64 hash(u64 seed, Slice<const u8> input) {
+                const std::uint8_t* bytes = reinterpret_cast<const std::uint8_t*>(input.ptr.raw_ptr);
+                std::size_t len = input.len.raw();
+                Wyhash self = init(seed);
+                if (len <= 16) {
+                    self.smallKey(bytes, len);
+                } else {
+                    std::size_t i = 0;
+                    if (len >= 48) {
+                        for (; i + 48 < len; i += 48) {
+                            self.round(bytes + i);
+                        }
+                        self.final0();
+                    }
+                    self.final1(bytes, len, i);
+                }
+                self.total_len = len;
+                return self.final2();
+            }
+
+        private:
+            static std::uint64_t read64(const std::uint8_t* p) {
+                std::uint64_t v;
+                std::memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                v = __builtin_bswap64(v);
+#endif
+                return v;
+            }
+
+            static std::uint64_t read32(const std::uint8_t* p) {
+                std::uint32_t v;
+                std::memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                v = __builtin_bswap32(v);
+#endif
+                return v;
+            }
+
+            static void mum(std::uint64_t& x, std::uint64_t& y) {
+                unsigned __int128 r = static_cast<unsigned __int128>(x) * y;
+                x = static_cast<std::uint64_t>(r);
+                y = static_cast<std::uint64_t>(r >> 64);
+            }
+
+            static std::uint64_t mix(std::uint64_t x, std::uint64_t y) {
+                mum(x, y);
+                return x ^ y;
+            }
+
+            void smallKey(const std::uint8_t* input, std::size_t len) {
+                if (len >= 4) {
+                    std::size_t end = len - 4;
+                    std::size_t quarter = (len >> 3) << 2;
+                    a = (read32(input) << 32) | read32(input + quarter);
+                    b = (read32(input + end) << 32) | read32(input + end - quarter);
+                } else if (len > 0) {
+                    a = (std::uint64_t(input[0]) << 16) | (std::uint64_t(input[len >> 1]) << 8) | input[len - 1];
+                    b = 0;
+                } else {
+                    a = 0;
+                    b = 0;
+                }
+            }
+
+            // Three independent multiply chains per 48 bytes.
+            void round(const std::uint8_t* input) {
+                for (std::size_t i = 0; i < 3; i++) {
+                    std::uint64_t x = read64(input + 16 * i);
+                    std::uint64_t y = read64(input + 16 * i + 8);
+                    state[i] = mix(x ^ secret[i + 1].raw(), y ^ state[i]);
+                }
+            }
+
+            void final0() {
+                state[0] ^= state[1] ^ state[2];
+            }
+
+            // `input` holds the last 17..48 bytes from `start`, with at least
+            // 16 readable bytes before the end.
+            void final1(const std::uint8_t* input, std::size_t input_len, std::size_t start) {
+                const std::uint8_t* tail = input + start;
+                std::size_t tail_len = input_len - start;
+                for (std::size_t i = 0; i + 16 < tail_len; i += 16) {
+                    state[0] = mix(read64(tail + i) ^ secret[1].raw(), read64(tail + i + 8) ^ state[0]);
+                }
+                a = read64(input + input_len - 16);
+                b = read64(input + input_len - 8);
+            }
+
+            u64 final2() {
+                a ^= secret[1].raw();
+                b ^= state[0];
+                mum(a, b);
+                return mix(a ^ secret[0].raw() ^ total_len, b ^ secret[1].raw());
+            }
+        };
+
+        inline u64 wyhash(u64 seed, Slice<const u8> input) {
+            return Wyhash::hash(seed, input);
+        }
+
+        namespace hash_impl {
+            template <typename H, typename T, typename = void>
+            struct has_hash_method : std::false_type {};
+
+            template <typename H, typename T>
+            struct has_hash_method<H, T, std::void_t<decltype(std::declval<const T&>().hash(std::declval<H&>()))>>
+                : std::true_type {};
+
+            // Slice, MiPtr and Ptr have unique object representations too, but
+            // hashing their bytes would hash an address instead of the items.
+            template <typename T> struct is_address_type : std::false_type {};
+            template <typename T> struct is_address_type<Slice<T>> : std::true_type {};
+            template <typename T> struct is_address_type<MiPtr<T>> : std::true_type {};
+            template <typename T> struct is_address_type<Ptr<T>> : std::true_type {};
+
+            template <typename T, typename = void>
+            struct holds_address_type;
+
+            // Converts to any field type, or with `plain_only` only to types
+            // that hold no Slice, MiPtr or Ptr.
+            template <bool plain_only>
+            struct AnyField {
+                template <typename U, typename = std::enable_if_t<!plain_only || !holds_address_type<U>::value>>
+                constexpr operator U() const;
+            };
+
+            template <std::size_t I, bool plain_only>
+            using AnyFieldAt = AnyField<plain_only>;
+
+            template <typename T, bool plain_only, typename Seq, typename = void>
+            struct is_brace_constructible : std::false_type {};
+
+            template <typename T, bool plain_only, std::size_t... I>
+            struct is_brace_constructible<T, plain_only, std::index_sequence<I...>,
+                std::void_t<decltype(T{AnyFieldAt<I, plain_only>{}...})>> : std::true_type {};
+
+            // Number of initializers the aggregate T accepts, array members
+            // count one per element.
+            template <typename T, std::size_t N = 0>
+            constexpr std::size_t fieldCount() {
+                if constexpr (N < 64 && is_brace_constructible<T, false, std::make_index_sequence<N + 1>>::value) {
+                    return fieldCount<T, N + 1>();
+                } else {
+                    return N;
+                }
+            }
+
+            // True for Slice, MiPtr, Ptr and aggregates or arrays holding one
+            // at any depth. Members of non-aggregate classes are not visible.
+            template <typename T, typename>
+            struct holds_address_type : is_address_type<T> {};
+
+            template <typename T, std::size_t N>
+            struct holds_address_type<T[N]> : holds_address_type<T> {};
+
+            template <typename T>
+            struct holds_address_type<T, std::enable_if_t<
+                std::is_aggregate_v<T> && !std::is_array_v<T> && !is_address_type<T>::value>>
+                : std::bool_constant<!is_brace_constructible<T, true, std::make_index_sequence<fieldCount<T>()>>::value> {};
+
+            template <typename T>
+            constexpr bool hashes_as_bytes = std::has_unique_object_representations_v<T> && !holds_address_type<T>::value;
+
+            template <typename H>
+            void hashBytes(H& hasher, const void* data, std::size_t len) {
+                if (len == 0) return;
+                hasher.update(Slice<const u8>{MiPtr<const u8>(static_cast<const u8*>(data)), len});
+            }
+        }
+
+        // Feeds `key` into a streaming hasher (anything with
+        // `update(Slice<const u8>)`):
+        // - types whose equal values have equal bytes (integers, enums,
+        //   pointers, SafeInt, padding-free aggregates of those) hash their
+        //   bytes
+        // - types with a `void hash(H&) const` member hash through it
+        // Floats and padded structs need the member, equal values may differ
+        // in their bytes there. So do aggregates holding a Slice, MiPtr or
+        // Ptr, their bytes are an address and not the items it points to.
+        template <typename H, typename T>
+        void autoHash(H& hasher, const T& key) {
+            if constexpr (hash_impl::has_hash_method<H, T>::value) {
+                key.hash(hasher);
+            } else {
+                static_assert(std::has_unique_object_representations_v<T>,
+                    "type has padding or floats, give it a `void hash(H&) const` member");
+                static_assert(!hash_impl::holds_address_type<T>::value,
+                    "type holds a Slice, MiPtr or Ptr, give it a `void hash(H&) const` member");
+                hash_impl::hashBytes(hasher, &key, sizeof(T));
+            }
+        }
+
+        // Hashes the length and then every element, so adjacent slices
+        // cannot collide by shifting items between them.
+        template <typename H, typename T>
+        void autoHash(H& hasher, const Slice<T>& key) {
+            autoHash(hasher, key.len);
+            if constexpr (hash_impl::hashes_as_bytes<T>) {
+                hash_impl::hashBytes(hasher, key.ptr.raw_ptr, key.len.raw() * sizeof(T));
+            } else {
+                for (std::size_t i = 0; i < key.len.raw(); i++) {
+                    autoHash(hasher, key.ptr.raw_ptr[i]);
+                }
+            }
+        }
+
+        template <typename H, typename T, std::size_t N>
+        void autoHash(H& hasher, const Array<T, N>& key) {
+            if constexpr (hash_impl::hashes_as_bytes<T>) {
+                hash_impl::hashBytes(hasher, key.items, N * sizeof(T));
+            } else {
+                for (std::size_t i = 0; i < N; i++) {
+                    autoHash(hasher, key.items[i]);
+                }
+            }
+        }
+
+        template <typename T>
+        u64 hashOf(const T& key, u64 seed = 0) {
+            Wyhash hasher = Wyhash::init(seed);
+            autoHash(hasher, key);
+            return hasher.final();
+        }
+
+        // Hash functor for hash containers, e.g.
+        // std::unordered_map<Key, V, stj::hash::AutoHash<Key>>.
+        template <typename T>
+        struct AutoHash {
+            std::size_t operator()(const T& key) const {
+                return static_cast<std::size_t>(hashOf(key).raw());
+            }
+        };
+    }
+}
+// ==== hash
+
+// mem ====
+// Byte search over Slice<const u8>. On x86 the scans use SSE2, or AVX2
+// when the CPU has it; the choice is made at runtime so binaries built
+// for baseline x86-64 still use 32-byte vectors.
+namespace stj {
+    namespace mem {
+        using sort::SearchError;
+
+        namespace mem_impl {
+            using Byte = std::uint8_t;
+
+            // Sets of up to this many bytes are matched with one compare per
+            // byte per vector, larger sets use a 256-bit table.
+            constexpr std::size_t max_vector_set = 16;
+
+            struct ByteSet {
+                std::uint64_t bits[4];
+
+                bool has(Byte b) const {
+                    return (bits[b >> 6] >> (b & 63)) & 1;
+                }
+            };
+
+            inline ByteSet makeByteSet(const Byte* set, std::size_t len) {
+                ByteSet result{};
+                for (std::size_t i = 0; i < len; i++) {
+                    result.bits[set[i] >> 6] |= std::uint64_t(1) << (set[i] & 63);
+                }
+                return result;
+            }
+
+            // Scalar versions, also used for the tails of the vector loops.
+            // All finders return nullptr when there is no match.
+            inline const Byte* findByteScalar(const Byte* p, const Byte* end, Byte c) {
+                for (; p < end; p++) {
+                    if (*p == c) return p;
+                }
+                return nullptr;
+            }
+
+            inline const Byte* findLastByteScalar(const Byte* begin, const Byte* end, Byte c) {
+                while (end > begin) {
+                    if (*--end == c) return end;
+                }
+                return nullptr;
+            }
+
+            inline const Byte* findAnyScalar(const Byte* p, const Byte* end, const ByteSet& set) {
+                for (; p < end; p++) {
+                    if (set.has(*p)) return p;
+                }
+                return nullptr;
+            }
+
+            inline const Byte* findSubstringScalar(const Byte* p, const Byte* end, const Byte* needle, std::size_t m) {
+                for (; p + m <= end; p++) {
+                    if (p[0] == needle[0] && std::memcmp(p, needle, m) == 0) return p;
+                }
+                return nullptr;
+            }
+
+#if defined(__SSE2__)
+            inline unsigned mask16(__m128i v) {
+                return static_cast<unsigned>(_mm_movemask_epi8(v));
+            }
+
+            inline const Byte* findByteSse2(const Byte* p, const Byte* end, Byte c) {
+                const __m128i needle = _mm_set1_epi8(static_cast<char>(c));
+                for (; end - p >= 64; p += 64) {
+                    __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), needle);
+                    __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16)), needle);
+                    __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32)), needle);
+                    __m128i e = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 48)), needle);
+                    if (mask16(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(d, e))) != 0) {
+                        std::uint64_t mask = mask16(a) | (mask16(b) << 16)
+                            | (std::uint64_t(mask16(d)) << 32) | (std::uint64_t(mask16(e)) << 48);
+                        return p + __builtin_ctzll(mask);
+                    }
+                }
+                for (; end - p >= 16; p += 16) {
+                    unsigned mask = mask16(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), needle));
+                    if (mask != 0) return p + __builtin_ctz(mask);
+                }
+                return findByteScalar(p, end, c);
+            }
+
+            inline const Byte* findLastByteSse2(const Byte* begin, const Byte* end, Byte c) {
+                const __m128i needle = _mm_set1_epi8(static_cast<char>(c));
+                while (end - begin >= 16) {
+                    end -= 16;
+                    unsigned mask = mask16(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(end)), needle));
+                    if (mask != 0) return end + 31 - __builtin_clz(mask);
+                }
+                return findLastByteScalar(begin, end, c);
+            }
+
+            inline const Byte* findAnySse2(const Byte* p, const Byte* end, const Byte* set, std::size_t set_len) {
+                __m128i needles[max_vector_set];
+                for (std::size_t i = 0; i < set_len; i++) {
+                    needles[i] = _mm_set1_epi8(static_cast<char>(set[i]));
+                }
+                for (; end - p >= 16; p += 16) {
+                    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                    __m128i hits = _mm_setzero_si128();
+                    for (std::size_t i = 0; i < set_len; i++) {
+                        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[i]));
+                    }
+                    unsigned mask = mask16(hits);
+                    if (mask != 0) return p + __builtin_ctz(mask);
+                }
+                return findAnyScalar(p, end, makeByteSet(set, set_len));
+            }
+
+            // Candidates must match the first and the last needle byte, only
+            // those are compared in full (Mula's generic SIMD search).
+            inline const Byte* findSubstringSse2(const Byte* p, const Byte* end, const Byte* needle, std::size_t m) {
+                const __m128i first = _mm_set1_epi8(static_cast<char>(needle[0]));
+                const __m128i last = _mm_set1_epi8(static_cast<char>(needle[m - 1]));
+                for (; end - p >= static_cast<std::ptrdiff_t>(m - 1 + 16); p += 16) {
+                    __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+                    __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + m - 1));
+                    unsigned mask = mask16(_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+                    while (mask != 0) {
+                        unsigned bit = __builtin_ctz(mask);
+                        if (std::memcmp(p + bit + 1, needle + 1, m - 2) == 0) return p + bit;
+                        mask &= mask - 1;
+                    }
+                }
+                return findSubstringScalar(p, end, needle, m);
+            }
+
+            [[gnu::target("avx2")]]
+            inline unsigned mask32(__m256i v) {
+                return static_cast<unsigned>(_mm256_movemask_epi8(v));
+            }
+
+            [[gnu::target("avx2")]]
+            inline const Byte* findByteAvx2(const Byte* p, const Byte* end, Byte c) {
+                const __m256i needle = _mm256_set1_epi8(static_cast<char>(c));
+                for (; end - p >= 128; p += 128) {
+                    __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), needle);
+                    __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32)), needle);
+                    __m256i d = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 64)), needle);
+                    __m256i e = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 96)), needle);
+                    __m256i any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(d, e));
+                    if (!_mm256_testz_si256(any, any)) {
+                        std::uint64_t low = mask32(a) | (std::uint64_t(mask32(b)) << 32);
+                        if (low != 0) return p + __builtin_ctzll(low);
+                        std::uint64_t high = mask32(d) | (std::uint64_t(mask32(e)) << 32);
+                        return p + 64 + __builtin_ctzll(high);
+                    }
+                }
+                for (; end - p >= 32; p += 32) {
+                    unsigned mask = mask32(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), needle));
+                    if (mask != 0) return p + __builtin_ctz(mask);
+                }
+                return findByteSse2(p, end, c);
+            }
+
+            [[gnu::target("avx2")]]
+            inline const Byte* findLastByteAvx2(const Byte* begin, const Byte* end, Byte c) {
+                const __m256i needle = _mm256_set1_epi8(static_cast<char>(c));
+                while (end - begin >= 32) {
+                    end -= 32;
+                    unsigned mask = mask32(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(end)), needle));
+                    if (mask != 0) return end + 31 - __builtin_clz(mask);
+                }
+                return findLastByteSse2(begin, end, c);
+            }
+
+            [[gnu::target("avx2")]]
+            inline const Byte* findAnyAvx2(const Byte* p, const Byte* end, const Byte* set, std::size_t set_len) {
+                __m256i needles[max_vector_set];
+                for (std::size_t i = 0; i < set_len; i++) {
+                    needles[i] = _mm256_set1_epi8(static_cast<char>(set[i]));
+                }
+                for (; end - p >= 32; p += 32) {
+                    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+                    __m256i hits = _mm256_setzero_si256();
+                    for (std::size_t i = 0; i < set_len; i++) {
+                        hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, needles[i]));
+                    }
+                    unsigned mask = mask32(hits);
+                    if (mask != 0) return p + __builtin_ctz(mask);
+                }
+                return findAnySse2(p, end, set, set_len);
+            }
+
+            [[gnu::target("avx2")]]
+            inline const Byte* findSubstringAvx2(const Byte* p, const Byte* end, const Byte* needle, std::size_t m) {
+                const __m256i first = _mm256_set1_epi8(static_cast<char>(needle[0]));
+                const __m256i last = _mm256_set1_epi8(static_cast<char>(needle[m - 1]));
+                for (; end - p >= static_cast<std::ptrdiff_t>(m - 1 + 32); p += 32) {
+                    __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+                    __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + m - 1));
+                    unsigned mask = mask32(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+                    while (mask != 0) {
+                        unsigned bit = __builtin_ctz(mask);
+                        if (std::memcmp(p + bit + 1, needle + 1, m - 2) == 0) return p + bit;
+                        mask &= mask - 1;
+                    }
+                }
+                return findSubstringSse2(p, end, needle, m);
+            }
+
+            inline bool hasAvx2() {
+#if defined(__AVX2__)
+                return true;
+#else
+                static const bool supported = __builtin_cpu_supports("avx2");
+                return supported;
+#endif
+            }
+#endif
+
+            inline const Byte* findByte(const Byte* p, const Byte* end, Byte c) {
+#if defined(__SSE2__)
+                return hasAvx2() ? findByteAvx2(p, end, c) : findByteSse2(p, end, c);
+#else
+                if (p == end) return nullptr;
+                return static_cast<const Byte*>(std::memchr(p, c, end - p));
+#endif
+            }
+
+            inline const Byte* findLastByte(const Byte* begin, const Byte* end, Byte c) {
+#if defined(__SSE2__)
+                return hasAvx2() ? findLastByteAvx2(begin, end, c) : findLastByteSse2(begin, end, c);
+#else
+                return findLastByteScalar(begin, end, c);
+#endif
+            }
+
+            inline const Byte* findAny(const Byte* p, const Byte* end, const Byte* set, std::size_t set_len) {
+                if (set_len == 1) return findByte(p, end, set[0]);
+#if defined(__SSE2__)
+                if (set_len <= max_vector_set) {
+                    return hasAvx2() ? findAnyAvx2(p, end, set, set_len) : findAnySse2(p, end, set, set_len);
+                }
+#endif
+                return findAnyScalar(p, end, makeByteSet(set, set_len));
+            }
+
+            inline const Byte* findSubstring(const Byte* p, const Byte* end, const Byte* needle, std::size_t m) {
+                if (m == 1) return findByte(p, end, needle[0]);
+#if defined(__SSE2__)
+                return hasAvx2() ? findSubstringAvx2(p, end, needle, m) : findSubstringSse2(p, end, needle, m);
+#else
+                return findSubstringScalar(p, end, needle, m);
+#endif
+            }
+
+            inline const Byte* bytes(Slice<const u8> slice) {
+                return reinterpret_cast<const Byte*>(slice.ptr.raw_ptr);
+            }
+
+            inline Result<usize, SearchError> indexFrom(Slice<const u8> slice, const Byte* found) {
+                if (found == nullptr) return SearchError::NotFound;
+                return usize(static_cast<std::size_t>(found - bytes(slice)));
+            }
+        }
+
+        inline Result<usize, SearchError> indexOfScalar(Slice<const u8> haystack, u8 value) {
+            const mem_impl::Byte* p = mem_impl::bytes(haystack);
+            return mem_impl::indexFrom(haystack, mem_impl::findByte(p, p + haystack.len.raw(), value.raw()));
+        }
+
+        inline Result<usize, SearchError> lastIndexOfScalar(Slice<const u8> haystack, u8 value) {
+            const mem_impl::Byte* p = mem_impl::bytes(haystack);
+            return mem_impl::indexFrom(haystack, mem_impl::findLastByte(p, p + haystack.len.raw(), value.raw()));
+        }
+
+        // Index of the first byte that is any of `values`.
+        inline Result<usize, SearchError> indexOfAny(Slice<const u8> haystack, Slice<const u8> values) {
+            if (values.len == 0) return SearchError::NotFound;
+            const mem_impl::Byte* p = mem_impl::bytes(haystack);
+            return mem_impl::indexFrom(haystack,
+                mem_impl::findAny(p, p + haystack.len.raw(), mem_impl::bytes(values), values.len.raw()));
+        }
+
+        // Index of the first occurrence of `needle`, an empty needle is
+        // found at 0.
+        inline Result<usize, SearchError> indexOf(Slice<const u8> haystack, Slice<const u8> needle) {
+            if (needle.len == 0) return usize(0);
+            if (needle.len > haystack.len) return SearchError::NotFound;
+            const mem_impl::Byte* p = mem_impl::bytes(haystack);
+            return mem_impl::indexFrom(haystack,
+                mem_impl::findSubstring(p, p + haystack.len.raw(), mem_impl::bytes(needle), needle.len.raw()));
+        }
+
+        // Index of the last occurrence of `needle`, an empty needle is found
+        // at `haystack.len`.
+        inline Result<usize, SearchError> lastIndexOf(Slice<const u8> haystack, Slice<const u8> needle) {
+            std::size_t m = needle.len.raw();
+            if (m == 0) return haystack.len;
+            if (needle.len > haystack.len) return SearchError::NotFound;
+            const mem_impl::Byte* begin = mem_impl::bytes(haystack);
+            const mem_impl::Byte* n = mem_impl::bytes(needle);
+            // Scan backwards for the needle's last byte, then compare.
+            const mem_impl::Byte* end = begin + haystack.len.raw();
+            while (true) {
+                const mem_impl::Byte* last = mem_impl::findLastByte(begin + m - 1, end, n[m - 1]);
+                if (last == nullptr) return SearchError::NotFound;
+                const mem_impl::Byte* start = last - (m - 1);
+                if (std::memcmp(start, n, m - 1) == 0) return usize(static_cast<std::size_t>(start - begin));
+                end = last;
+            }
+        }
+
+        namespace mem_impl {
+            // Lets the token iterators drive range-for loops.
+            template <typename It>
+            struct Cursor {
+                It it;
+                Slice<const u8> current;
+                bool done;
+
+                Slice<const u8> operator*() const {
+                    return current;
+                }
+
+                Cursor& operator++() {
+                    Result<Slice<const u8>, SearchError> next = it.next();
+                    done = next.hasAnyError();
+                    if (!done) current = next.value();
+                    return *this;
+                }
+
+                bool operator!=(const Cursor& other) const {
+                    return done != other.done;
+                }
+            };
+
+            template <typename It>
+            Cursor<It> begin(const It& it) {
+                Cursor<It> cursor{it, Slice<const u8>::empty(), false};
+                ++cursor;
+                return cursor;
+            }
+
+            template <typename It>
+            Cursor<It> end(const It& it) {
+                return Cursor<It>{it, Slice<const u8>::empty(), true};
+            }
+        }
+
+        // Yields the parts between delimiters, including empty ones:
+        // "a,,b" gives "a", "", "b". next() returns NotFound once exhausted.
+        struct SplitIterator {
+            Slice<const u8> buffer;
+            usize index;
+            u8 delimiter;
+            bool done;
+
+            Result<Slice<const u8>, SearchError> next() {
+                if (done) return SearchError::NotFound;
+                const mem_impl::Byte* p = mem_impl::bytes(buffer);
+                const mem_impl::Byte* end = p + buffer.len.raw();
+                const mem_impl::Byte* start = p + index.raw();
+                const mem_impl::Byte* found = mem_impl::findByte(start, end, delimiter.raw());
+                if (found == nullptr) {
+                    done = true;
+                    found = end;
+                    index = buffer.len;
+                } else {
+                    index = usize(static_cast<std::size_t>(found - p) + 1);
+                }
+                return buffer.slice(static_cast<std::size_t>(start - p), static_cast<std::size_t>(found - p));
+            }
+
+            // Everything not yet returned.
+            Slice<const u8> rest() const {
+                return buffer.slice(index);
+            }
+
+            mem_impl::Cursor<SplitIterator> begin() const { return mem_impl::begin(*this); }
+            mem_impl::Cursor<SplitIterator> end() const { return mem_impl::end(*this); }
+        };
+
+        // Yields the non-empty runs between delimiters: ",a,,b," gives "a", "b".
+        struct TokenIterator {
+            Slice<const u8> buffer;
+            usize index;
+            u8 delimiter;
+
+            Result<Slice<const u8>, SearchError> next() {
+                const mem_impl::Byte* p = mem_impl::bytes(buffer);
+                std::size_t len = buffer.len.raw();
+                std::size_t start = index.raw();
+                while (start < len && p[start] == delimiter.raw()) start++;
+                if (start == len) {
+                    index = buffer.len;
+                    return SearchError::NotFound;
+                }
+                const mem_impl::Byte* found = mem_impl::findByte(p + start, p + len, delimiter.raw());
+                std::size_t end = found == nullptr ? len : static_cast<std::size_t>(found - p);
+                index = end;
+                return buffer.slice(start, end);
+            }
+
+            Slice<const u8> rest() const {
+                return buffer.slice(index);
+            }
+
+            mem_impl::Cursor<TokenIterator> begin() const { return mem_impl::begin(*this); }
+            mem_impl::Cursor<TokenIterator> end() const { return mem_impl::end(*this); }
+        };
+
+        // Yields lines without their "\n" or "\r\n". A final newline does not
+        // start another, empty, line.
+        struct LineIterator {
+            SplitIterator split;
+
+            Result<Slice<const u8>, SearchError> next() {
+                if (!split.done && split.index == split.buffer.len) return SearchError::NotFound;
+                Result<Slice<const u8>, SearchError> line = split.next();
+                if (line.hasAnyError()) return line;
+                Slice<const u8> bytes = line.value();
+                if (bytes.len > 0 && bytes.ptr.raw_ptr[bytes.len.raw() - 1] == '\r') {
+                    bytes = bytes.slice(0, bytes.len - 1);
+                }
+                return bytes;
+            }
+
+            mem_impl::Cursor<LineIterator> begin() const { return mem_impl::begin(*this); }
+            mem_impl::Cursor<LineIterator> end() const { return mem_impl::end(*this); }
+        };
+
+        inline SplitIterator split(Slice<const u8> buffer, u8 delimiter) {
+            return SplitIterator{buffer, 0, delimiter, false};
+        }
+
+        inline TokenIterator tokenize(Slice<const u8> buffer, u8 delimiter) {
+            return TokenIterator{buffer, 0, delimiter};
+        }
+
+        inline LineIterator lines(Slice<const u8> buffer) {
+            return LineIterator{split(buffer, '\n')};
+        }
+    }
+}
+// ==== mem
+
+// bit set ====
+namespace stj {
+    namespace bitset_impl {
+        using Word = std::uint64_t;
+        constexpr std::size_t word_bits = 64;
+
+        constexpr std::size_t wordCount(std::size_t bit_length) {
+            return (bit_length + word_bits - 1) / word_bits;
+        }
+
+        // Bits of the last word that are inside the set, the rest stay zero
+        // so count() and iteration never see them.
+        constexpr Word lastWordMask(std::size_t bit_length) {
+            std::size_t used = bit_length % word_bits;
+            return used == 0 ? ~Word(0) : (Word(1) << used) - 1;
+        }
+
+        enum class Op {
+            Or,
+            And,
+            AndNot,
+            Xor,
+        };
+
+        template <Op O>
+        inline Word apply(Word a, Word b) {
+            if constexpr (O == Op::Or) return a | b;
+            if constexpr (O == Op::And) return a & b;
+            if constexpr (O == Op::AndNot) return a & ~b;
+            if constexpr (O == Op::Xor) return a ^ b;
+        }
+
+#if defined(__SSE2__)
+        template <Op O>
+        inline __m128i apply128(__m128i a, __m128i b) {
+            if constexpr (O == Op::Or) return _mm_or_si128(a, b);
+            if constexpr (O == Op::And) return _mm_and_si128(a, b);
+            if constexpr (O == Op::AndNot) return _mm_andnot_si128(b, a);
+            if constexpr (O == Op::Xor) return _mm_xor_si128(a, b);
+        }
+#endif
+
+#if defined(__AVX2__)
+        template <Op O>
+        inline __m256i apply256(__m256i a, __m256i b) {
+            if constexpr (O == Op::Or) return _mm256_or_si256(a, b);
+            if constexpr (O == Op::And) return _mm256_and_si256(a, b);
+            if constexpr (O == Op::AndNot) return _mm256_andnot_si256(b, a);
+            if constexpr (O == Op::Xor) return _mm256_xor_si256(a, b);
+        }
+#endif
+
+        // dst[i] = dst[i] op src[i] over whole words.
+        template <Op O>
+        inline void combine(Word* dst, const Word* src, std::size_t words) {
+            std::size_t i = 0;
+#if defined(__AVX2__)
+            for (; i + 4 <= words; i += 4) {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), apply256<O>(a, b));
+            }
+#endif
+#if defined(__SSE2__)
+            for (; i + 2 <= words; i += 2) {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), apply128<O>(a, b));
+            }
+#endif
+            for (; i < words; i++) {
+                dst[i] = apply<O>(dst[i], src[i]);
+            }
+        }
+
+        inline std::size_t countGeneric(const Word* words, std::size_t len) {
+            std::size_t total = 0;
+            for (std::size_t i = 0; i < len; i++) {
+                total += __builtin_popcountll(words[i]);
+            }
+            return total;
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        // Baseline x86-64 has no POPCNT, __builtin_popcountll would become a
+        // bit-twiddling sequence without this.
+        [[gnu::target("popcnt")]]
+        inline std::size_t countPopcnt(const Word* words, std::size_t len) {
+            std::size_t total = 0;
+            for (std::size_t i = 0; i < len; i++) {
+                total += __builtin_popcountll(words[i]);
+            }
+            return total;
+        }
+#endif
+
+        inline std::size_t count(const Word* words, std::size_t len) {
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__POPCNT__)
+            static const bool has_popcnt = __builtin_cpu_supports("popcnt");
+            if (has_popcnt) return countPopcnt(words, len);
+#endif
+            return countGeneric(words, len);
+        }
+
+        inline void setRange(Word* words, std::size_t start, std::size_t end, bool value) {
+            if (start >= end) return;
+            std::size_t first = start / word_bits;
+            std::size_t last = (end - 1) / word_bits;
+            Word first_mask = ~Word(0) << (start % word_bits);
+            Word last_mask = ~Word(0) >> (word_bits - 1 - (end - 1) % word_bits);
+            if (first == last) {
+                Word mask = first_mask & last_mask;
+                words[first] = value ? words[first] | mask : words[first] & ~mask;
+                return;
+            }
+            words[first] = value ? words[first] | first_mask : words[first] & ~first_mask;
+            for (std::size_t i = first + 1; i < last; i++) {
+                words[i] = value ? ~Word(0) : 0;
+            }
+            words[last] = value ? words[last] | last_mask : words[last] & ~last_mask;
+        }
+
+        constexpr void checkIndex(usize index, std::size_t bit_length) {
+            if (index >= bit_length) [[unlikely]] {
+                PANIC("bit index is greater than bit set length");
+            }
+        }
+
+        // Visits set bits in increasing order, one count-trailing-zeros per
+        // set bit and one load per word.
+        struct SetBitIterator {
+            const Word* words;
+            std::size_t word_len;
+            std::size_t word_index;
+            Word current;
+
+            static SetBitIterator init(const Word* words, std::size_t word_len) {
+                return SetBitIterator{words, word_len, 0, word_len > 0 ? words[0] : 0};
+            }
+
+            Result<usize, sort::SearchError> next() {
+                while (current == 0) {
+                    if (++word_index >= word_len) {
+                        word_index = word_len;
+                        return sort::SearchError::NotFound;
+                    }
+                    current = words[word_index];
+                }
+                std::size_t bit = __builtin_ctzll(current);
+                current &= current - 1;
+                return usize(word_index * word_bits + bit);
+            }
+
+            struct Cursor {
+                SetBitIterator* it;
+                std::size_t current;
+                bool done;
+
+                usize operator*() const {
+                    return current;
+                }
+
+                Cursor& operator++() {
+                    Result<usize, sort::SearchError> next = it->next();
+                    done = next.hasAnyError();
+                    if (!done) current = next.value().raw();
+                    return *this;
+                }
+
+                bool operator!=(const Cursor& other) const {
+                    return done != other.done;
+                }
+            };
+
+            Cursor begin() {
+                Cursor cursor{this, 0, false};
+                ++cursor;
+                return cursor;
+            }
+
+            Cursor end() {
+                return Cursor{this, 0, true};
+            }
+        };
+    }
+
+    // Bit set with a compile-time length, stored inline.
+    template <std::size_t N>
+    struct StaticBitSet {
+        static_assert(N > 0, "StaticBitSet length must be greater than zero");
+
+        using Word = bitset_impl::Word;
+        static constexpr std::size_t word_len = bitset_impl::wordCount(N);
+        static constexpr usize bit_length = N;
+
+        Word masks[word_len];
+
+        static constexpr StaticBitSet initEmpty() {
+            StaticBitSet self{};
+            return self;
+        }
+
+        static constexpr StaticBitSet initFull() {
+            StaticBitSet self{};
+            for (std::size_t i = 0; i < word_len; i++) {
+                self.masks[i] = ~Word(0);
+            }
+            self.masks[word_len - 1] = bitset_impl::lastWordMask(N);
+            return self;
+        }
+
+        constexpr bool isSet(usize index) const {
+            bitset_impl::checkIndex(index, N);
+            return (masks[index.raw() / 64] >> (index.raw() % 64)) & 1;
+        }
+
+        constexpr void set(usize index) {
+            bitset_impl::checkIndex(index, N);
+            masks[index.raw() / 64] |= Word(1) << (index.raw() % 64);
+        }
+
+        constexpr void unset(usize index) {
+            bitset_impl::checkIndex(index, N);
+            masks[index.raw() / 64] &= ~(Word(1) << (index.raw() % 64));
+        }
+
+        constexpr void toggle(usize index) {
+            bitset_impl::checkIndex(index, N);
+            masks[index.raw() / 64] ^= Word(1) << (index.raw() % 64);
+        }
+
+        constexpr void setValue(usize index, bool value) {
+            if (value) set(index); else unset(index);
+        }
+
+        // Sets or clears the bits in [start, end).
+        void setRangeValue(usize start, usize end, bool value) {
+            if (end > N || start > end) [[unlikely]] {
+                PANIC("bit range is outside the bit set");
+            }
+            bitset_impl::setRange(masks, start.raw(), end.raw(), value);
+        }
+
+        usize count() const {
+            return bitset_impl::count(masks, word_len);
+        }
+
+        void setUnion(const StaticBitSet& other) {
+            bitset_impl::combine<bitset_impl::Op::Or>(masks, other.masks, word_len);
+        }
+
+        void setIntersection(const StaticBitSet& other) {
+            bitset_impl::combine<bitset_impl::Op::And>(masks, other.masks, word_len);
+        }
+
+        // Clears every bit that is set in `other`.
+        void setDifference(const StaticBitSet& other) {
+            bitset_impl::combine<bitset_impl::Op::AndNot>(masks, other.masks, word_len);
+        }
+
+        void toggleSet(const StaticBitSet& other) {
+            bitset_impl::combine<bitset_impl::Op::Xor>(masks, other.masks, word_len);
+        }
+
+        Result<usize, sort::SearchError> findFirstSet() const {
+            return iterator().next();
+        }
+
+        bool eql(const StaticBitSet& other) const {
+            return std::memcmp(masks, other.masks, sizeof(masks)) == 0;
+        }
+
+        // Indices of the set bits in increasing order, also usable in
+        // range-for. Modifying the set while iterating is not supported.
+        bitset_impl::SetBitIterator iterator() const {
+            return bitset_impl::SetBitIterator::init(masks, word_len);
+        }
+    };
+
+    // Bit set whose length is chosen at runtime, storage comes from an
+    // Allocator passed to each call that may allocate, like ArrayList.
+    struct DynamicBitSet {
+        using Word = bitset_impl::Word;
+
+        Slice<Word> masks = Slice<Word>::empty();
+        usize bit_length = 0;
+
+        static DynamicBitSet initEmpty(heap::Allocator allocator, usize bit_length) {
+            DynamicBitSet self;
+            self.bit_length = bit_length;
+            std::size_t words = bitset_impl::wordCount(bit_length.raw());
+            if (words > 0) {
+                self.masks = allocator.alloc<Word>(words);
+                std::memset(self.masks.ptr.raw_ptr, 0, words * sizeof(Word));
+            }
+            return self;
+        }
+
+        static DynamicBitSet initFull(heap::Allocator allocator, usize bit_length) {
+            DynamicBitSet self = initEmpty(allocator, bit_length);
+            self.setRangeValue(0, bit_length, true);
+            return self;
+        }
+
+        void deinit(heap::Allocator allocator) {
+            if (masks.len == 0) {
+                return;
+            }
+            allocator.free(masks);
+            masks = Slice<Word>::empty();
+            bit_length = 0;
+        }
+
+        // Changes the length, new bits are set to `fill`.
+        void resize(heap::Allocator allocator, usize new_length, bool fill) {
+            std::size_t old_length = bit_length.raw();
+            std::size_t old_words = masks.len.raw();
+            std::size_t new_words = bitset_impl::wordCount(new_length.raw());
+            if (new_words != old_words) {
+                if (new_words == 0) {
+                    allocator.free(masks);
+                    masks = Slice<Word>::empty();
+                } else if (old_words == 0) {
+                    masks = allocator.alloc<Word>(new_words);
+                } else {
+                    masks = allocator.realloc(masks, new_words);
+                }
+                for (std::size_t i = old_words; i < new_words; i++) {
+                    masks.ptr.raw_ptr[i] = 0;
+                }
+            }
+            bit_length = new_length;
+            if (new_length.raw() > old_length) {
+                setRangeValue(old_length, new_length, fill);
+            } else if (new_words > 0) {
+                masks.ptr.raw_ptr[new_words - 1] &= bitset_impl::lastWordMask(new_length.raw());
+            }
+        }
+
+        bool isSet(usize index) const {
+            bitset_impl::checkIndex(index, bit_length.raw());
+            return (masks.ptr.raw_ptr[index.raw() / 64] >> (index.raw() % 64)) & 1;
+        }
+
+        void set(usize index) {
+            bitset_impl::checkIndex(index, bit_length.raw());
+            masks.ptr.raw_ptr[index.raw() / 64] |= Word(1) << (index.raw() % 64);
+        }
+
+        void unset(usize index) {
+            bitset_impl::checkIndex(index, bit_length.raw());
+            masks.ptr.raw_ptr[index.raw() / 64] &= ~(Word(1) << (index.raw() % 64));
+        }
+
+        void toggle(usize index) {
+            bitset_impl::checkIndex(index, bit_length.raw());
+            masks.ptr.raw_ptr[index.raw() / 64] ^= Word(1) << (index.raw() % 64);
+        }
+
+        void setValue(usize index, bool value) {
+            if (value) set(index); else unset(index);
+        }
+
+        // Sets or clears the bits in [start, end).
+        void setRangeValue(usize start, usize end, bool value) {
+            if (end > bit_length || start > end) [[unlikely]] {
+                PANIC("bit range is outside the bit set");
+            }
+            bitset_impl::setRange(masks.ptr.raw_ptr, start.raw(), end.raw(), value);
+        }
+
+        usize count() const {
+            return bitset_impl::count(masks.ptr.raw_ptr, masks.len.raw());
+        }
+
+        // The set operations need both sets to have the same length.
+        void setUnion(const DynamicBitSet& other) {
+            checkSameLength(other);
+            bitset_impl::combine<bitset_impl::Op::Or>(masks.ptr.raw_ptr, other.masks.ptr.raw_ptr, masks.len.raw());
+        }
+
+        void setIntersection(const DynamicBitSet& other) {
+            checkSameLength(other);
+            bitset_impl::combine<bitset_impl::Op::And>(masks.ptr.raw_ptr, other.masks.ptr.raw_ptr, masks.len.raw());
+        }
+
+        // Clears every bit that is set in `other`.
+        void setDifference(const DynamicBitSet& other) {
+            checkSameLength(other);
+            bitset_impl::combine<bitset_impl::Op::AndNot>(masks.ptr.raw_ptr, other.masks.ptr.raw_ptr, masks.len.raw());
+        }
+
+        void toggleSet(const DynamicBitSet& other) {
+            checkSameLength(other);
+            bitset_impl::combine<bitset_impl::Op::Xor>(masks.ptr.raw_ptr, other.masks.ptr.raw_ptr, masks.len.raw());
+        }
+
+        Result<usize, sort::SearchError> findFirstSet() const {
+            return iterator().next();
+        }
+
+        bitset_impl::SetBitIterator iterator() const {
+            return bitset_impl::SetBitIterator::init(masks.ptr.raw_ptr, masks.len.raw());
+        }
+
+    private:
+        void checkSameLength(const DynamicBitSet& other) const {
+            if (bit_length != other.bit_length) [[unlikely]] {
+                PANIC("bit sets have different lengths");
+            }
+        }
+    };
+}
+// ==== bit set
+
+// integer text ====
+namespace stj {
+    namespace fmt {
+        enum class ParseError {
+            InvalidCharacter,
+            Overflow,
+        };
+
+        enum class FormatError {
+            NoSpaceLeft,
+        };
+
+        namespace int_impl {
+            inline constexpr char digit_pairs[201] =
+                "00010203040506070809"
+                "10111213141516171819"
+                "20212223242526272829"
+                "30313233343536373839"
+                "40414243444546474849"
+                "50515253545556575859"
+                "60616263646566676869"
+                "70717273747576777879"
+                "80818283848586878889"
+                "90919293949596979899";
+
+            inline constexpr char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+            // Writes `value` in `base` right-aligned so that it ends at `end`
+            // and returns where it starts. Base 10 emits two digits per
+            // division through digit_pairs.
+            template <typename U>
+            char* formatUnsigned(char* end, U value, unsigned base) {
+                static_assert(std::is_unsigned_v<U>, "formatUnsigned needs an unsigned type");
+                char* p = end;
+                if (base == 10) {
+                    while (value >= 100) {
+                        unsigned pair = static_cast<unsigned>(value % 100) * 2;
+                        value /= 100;
+                        *--p = digit_pairs[pair + 1];
+                        *--p = digit_pairs[pair];
+                    }
+                    if (value < 10) {
+                        *--p = static_cast<char>('0' + value);
+                    } else {
+                        unsigned pair = static_cast<unsigned>(value) * 2;
+                        *--p = digit_pairs[pair + 1];
+                        *--p = digit_pairs[pair];
+                    }
+                } else if (base == 16) {
+                    do {
+                        *--p = digits[value & 0xf];
+                        value >>= 4;
+                    } while (value != 0);
+                } else {
+                    do {
+                        *--p = digits[value % base];
+                        value /= base;
+                    } while (value != 0);
+                }
+                return p;
+            }
+
+            template <typename U>
+            std::size_t decimalLength(U value) {
+                std::size_t len = 1;
+                while (true) {
+                    if (value < 10) return len;
+                    if (value < 100) return len + 1;
+                    if (value < 1000) return len + 2;
+                    if (value < 10000) return len + 3;
+                    value /= 10000;
+                    len += 4;
+                }
+            }
+
+            // Longest rendering of an integer of `size` bytes: base 2 plus sign.
+            constexpr std::size_t maxDigits(std::size_t size) {
+                return size * 8 + 1;
+            }
+
+            inline std::uint64_t load64(const std::uint8_t* p) {
+                std::uint64_t v;
+                std::memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                v = __builtin_bswap64(v);
+#endif
+                return v;
+            }
+
+            // Whether all 8 bytes are '0'..'9' (Lemire).
+            inline bool isEightDigits(std::uint64_t v) {
+                return (((v & 0xF0F0F0F0F0F0F0F0ull)
+                    | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4))
+                    == 0x3333333333333333ull);
+            }
+
+            // Value of 8 ASCII digits, first digit in the lowest byte, with
+            // three multiplies instead of eight.
+            inline std::uint64_t parseEightDigits(std::uint64_t v) {
+                v -= 0x3030303030303030ull;
+                v = (v * 10) + (v >> 8);
+                v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32)))
+                    + (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+                return v;
+            }
+
+            inline int digitValue(std::uint8_t c) {
+                if (c >= '0' && c <= '9') return c - '0';
+                if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+                if (c >= 'A' && c <= 'Z') return c - 'A' + 10;
+                return 36;
+            }
+
+            // Decimal digits into a 64-bit magnitude. At most 19 digits can
+            // not overflow, they are consumed 8 at a time.
+            [[gnu::always_inline]] inline Result<u64, ParseError> parseDecimal(const std::uint8_t* p, std::size_t len) {
+                while (len > 0 && *p == '0') {
+                    p++;
+                    len--;
+                }
+                std::uint64_t value = 0;
+                std::size_t fast_len = std::min<std::size_t>(len, 19);
+                std::size_t i = 0;
+                for (; i + 8 <= fast_len; i += 8) {
+                    std::uint64_t chunk = load64(p + i);
+                    if (!isEightDigits(chunk)) {
+                        return ParseError::InvalidCharacter;
+                    }
+                    value = value * 100000000 + parseEightDigits(chunk);
+                }
+                for (; i < fast_len; i++) {
+                    unsigned digit = static_cast<unsigned>(p[i]) - '0';
+                    if (digit > 9) {
+                        return ParseError::InvalidCharacter;
+                    }
+                    value = value * 10 + digit;
+                }
+
+                // Report bad characters ahead of overflow.
+                for (std::size_t j = i; j < len; j++) {
+                    if (static_cast<unsigned>(p[j]) - '0' > 9) {
+                        return ParseError::InvalidCharacter;
+                    }
+                }
+                for (; i < len; i++) {
+                    if (__builtin_mul_overflow(value, 10, &value)
+                        || __builtin_add_overflow(value, static_cast<std::uint64_t>(p[i] - '0'), &value)) {
+                        return ParseError::Overflow;
+                    }
+                }
+                return u64(value);
+            }
+
+            inline Result<u64, ParseError> parseAnyBase(const std::uint8_t* p, std::size_t len, unsigned base) {
+                std::uint64_t value = 0;
+                bool overflow = false;
+                for (std::size_t i = 0; i < len; i++) {
+                    int digit = digitValue(p[i]);
+                    if (digit >= static_cast<int>(base)) {
+                        return ParseError::InvalidCharacter;
+                    }
+                    overflow |= __builtin_mul_overflow(value, base, &value);
+                    overflow |= __builtin_add_overflow(value, static_cast<std::uint64_t>(digit), &value);
+                }
+                if (overflow) {
+                    return ParseError::Overflow;
+                }
+                return u64(value);
+            }
+        }
+
+        // Parses an optionally signed integer in `base` (2 to 36). Base 0
+        // picks 16, 8 or 2 from a 0x, 0o or 0b prefix and 10 otherwise.
+        // InvalidCharacter is reported ahead of Overflow when the text has
+        // both.
+        template <typename T>
+        Result<SafeInt<T>, ParseError> parseInt(Slice<const u8> text, u8 base = 10) {
+            static_assert(std::is_integral_v<T> && sizeof(T) <= 8, "parseInt supports integers up to 64 bits");
+            if (base == 1 || base > 36) [[unlikely]] {
+                PANIC("parseInt base must be 0 or between 2 and 36");
+            }
+            const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(text.ptr.raw_ptr);
+            std::size_t len = text.len.raw();
+            unsigned radix = base.raw();
+
+            bool negative = false;
+            if (len > 0 && (p[0] == '-' || p[0] == '+')) {
+                negative = p[0] == '-';
+                p++;
+                len--;
+            }
+            if (radix == 0) {
+                radix = 10;
+                if (len > 2 && p[0] == '0') {
+                    std::uint8_t prefix = p[1] | 0x20;
+                    if (prefix == 'x') radix = 16;
+                    if (prefix == 'o') radix = 8;
+                    if (prefix == 'b') radix = 2;
+                    if (radix != 10) {
+                        p += 2;
+                        len -= 2;
+                    }
+                }
+            }
+            if (len == 0) {
+                return ParseError::InvalidCharacter;
+            }
+
+            Result<u64, ParseError> parsed = radix == 10
+                ? int_impl::parseDecimal(p, len)
+                : int_impl::parseAnyBase(p, len, radix);
+            if (parsed.hasAnyError()) {
+                return parsed.template error<ParseError>();
+            }
+
+            using U = std::make_unsigned_t<T>;
+            std::uint64_t magnitude = parsed.value().raw();
+            std::uint64_t limit = static_cast<std::uint64_t>(std::numeric_limits<T>::max());
+            if constexpr (std::is_signed_v<T>) {
+                limit += negative;
+            } else if (negative && magnitude != 0) {
+                return ParseError::Overflow;
+            }
+            if (magnitude > limit) {
+                return ParseError::Overflow;
+            }
+            U bits = static_cast<U>(magnitude);
+            if (negative) {
+                bits = U(0) - bits;
+            }
+            return SafeInt<T>(static_cast<T>(bits));
+        }
+
+        // Parses every `delimiter` separated field of `text` and appends the
+        // values to `list`, a trailing delimiter is allowed. Returns how many
+        // values were appended, on error the values before the bad field
+        // stay in `list`.
+        template <typename T, typename A>
+        Result<usize, ParseError> parseDelimited(
+            ArrayList<SafeInt<T>, A>& list,
+            heap::AllocatorRef<A> allocator,
+            Slice<const u8> text,
+            u8 delimiter,
+            u8 base = 10
+        ) {
+            const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(text.ptr.raw_ptr);
+            const std::uint8_t* end = p + text.len.raw();
+            std::size_t count = 0;
+            while (p < end) {
+                const std::uint8_t* found = mem::mem_impl::findByte(p, end, delimiter.raw());
+                const std::uint8_t* field_end = found == nullptr ? end : found;
+                Slice<const u8> field{MiPtr<const u8>(reinterpret_cast<const u8*>(p)), static_cast<std::size_t>(field_end - p)};
+                Result<SafeInt<T>, ParseError> value = parseInt<T>(field, base);
+                if (value.hasAnyError()) {
+                    return value.template error<ParseError>();
+                }
+                list.append(allocator, value.value());
+                count++;
+                p = field_end + 1;
+            }
+            return usize(count);
+        }
+
+        // Writes `value` in `base` (2 to 36, lowercase) to the front of
+        // `buffer` and returns the number of bytes written.
+        template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+        Result<usize, FormatError> formatInt(Slice<u8> buffer, T value, u8 base = 10) {
+            if (base < 2 || base > 36) [[unlikely]] {
+                PANIC("formatInt base must be between 2 and 36");
+            }
+            using U = std::make_unsigned_t<T>;
+            char digits[int_impl::maxDigits(sizeof(T))];
+            char* end = digits + sizeof(digits);
+            bool negative = false;
+            U magnitude = static_cast<U>(value);
+            if constexpr (std::is_signed_v<T>) {
+                negative = value < 0;
+                if (negative) magnitude = U(0) - magnitude;
+            }
+            // Decimal output is sized up front and written in place.
+            if (base == 10) {
+                std::size_t len = negative + int_impl::decimalLength(magnitude);
+                if (len > buffer.len) {
+                    return FormatError::NoSpaceLeft;
+                }
+                char* out = reinterpret_cast<char*>(buffer.ptr.raw_ptr);
+                int_impl::formatUnsigned(out + len, magnitude, 10);
+                if (negative) out[0] = '-';
+                return usize(len);
+            }
+
+            char* begin = int_impl::formatUnsigned(end, magnitude, base.raw());
+            if (negative) *--begin = '-';
+
+            std::size_t len = static_cast<std::size_t>(end - begin);
+            if (len > buffer.len) {
+                return FormatError::NoSpaceLeft;
+            }
+            std::memcpy(buffer.ptr.raw_ptr, begin, len);
+            return usize(len);
+        }
+
+        template <typename T>
+        Result<usize, FormatError> formatInt(Slice<u8> buffer, SafeInt<T> value, u8 base = 10) {
+            return formatInt(buffer, value.raw(), base);
+        }
+    }
+}
+// ==== integer text
+
+// io ====
+// Format strings are checked at compile time, pass them through FMT:
+//     TRY(writer.print(FMT("{s}: {d} items, {x}\n"), name, count, mask));
+// Placeholders are `{}` or `{spec}` with spec one of
+//     d  decimal integer, fixed notation float
+//     x  lowercase hex integer
+//     e  scientific notation float
+//     s  string or byte slice
+//     c  single character
+// `{{` and `}}` write a literal brace.
+#define FMT(str) ([] { \
+    struct _stj_format_string { \
+        static constexpr const char* string() { return str; } \
+        static constexpr std::size_t length() { return sizeof(str) - 1; } \
+    }; \
+    return _stj_format_string{}; \
+}())
+
+namespace stj {
+    namespace io {
+        enum class WriteError {
+            NoSpaceLeft,
+            BrokenPipe,
+            DiskQuota,
+            WouldBlock,
+            InputOutput,
+        };
+
+        namespace fmt_impl {
+            enum class PieceKind : std::uint8_t {
+                Literal,
+                Arg,
+            };
+
+            struct Piece {
+                PieceKind kind;
+                std::size_t begin;
+                std::size_t end;
+                char spec;
+                std::size_t arg;
+            };
+
+            enum class Status : std::uint8_t {
+                Ok,
+                UnclosedBrace,
+                UnmatchedBrace,
+                BadSpec,
+            };
+
+            template <std::size_t N>
+            struct Parsed {
+                Piece pieces[N];
+                std::size_t count;
+                std::size_t args;
+                Status status;
+            };
+
+            constexpr bool knownSpec(char spec) {
+                return spec == 'd' || spec == 'x' || spec == 'e' || spec == 's' || spec == 'c';
+            }
+
+            template <typename F>
+            constexpr auto parse() {
+                constexpr const char* str = F::string();
+                constexpr std::size_t len = F::length();
+                Parsed<len + 1> out{};
+                std::size_t literal_begin = 0;
+                auto addLiteral = [&](std::size_t end) {
+                    if (end > literal_begin) {
+                        out.pieces[out.count++] = Piece{PieceKind::Literal, literal_begin, end, 0, 0};
+                    }
+                };
+
+                std::size_t i = 0;
+                while (i < len) {
+                    char c = str[i];
+                    if ((c == '{' || c == '}') && i + 1 < len && str[i + 1] == c) {
+                        addLiteral(i + 1);
+                        i += 2;
+                        literal_begin = i;
+                        continue;
+                    }
+                    if (c == '}') {
+                        out.status = Status::UnmatchedBrace;
+                        return out;
+                    }
+                    if (c == '{') {
+                        addLiteral(i);
+                        std::size_t close = i + 1;
+                        while (close < len && str[close] != '}') close++;
+                        if (close == len) {
+                            out.status = Status::UnclosedBrace;
+                            return out;
+                        }
+                        char spec = 0;
+                        if (close - i == 2) {
+                            spec = str[i + 1];
+                        }
+                        if (close - i > 2 || (spec != 0 && !knownSpec(spec))) {
+                            out.status = Status::BadSpec;
+                            return out;
+                        }
+                        out.pieces[out.count++] = Piece{PieceKind::Arg, 0, 0, spec, out.args++};
+                        i = close + 1;
+                        literal_begin = i;
+                        continue;
+                    }
+                    i++;
+                }
+                addLiteral(len);
+                return out;
+            }
+
+            template <typename F>
+            inline constexpr auto parsed_v = parse<F>();
+
+            template <typename T> struct is_slice : std::false_type {};
+            template <typename T> struct is_slice<Slice<T>> : std::true_type { using Item = T; };
+
+            template <typename T> struct is_array : std::false_type {};
+            template <typename T, std::size_t N> struct is_array<Array<T, N>> : std::true_type { using Item = T; };
+
+            template <typename T> struct is_result : std::false_type {};
+            template <typename T, typename... Enums> struct is_result<Result<T, Enums...>> : std::true_type {};
+
+            template <typename T> struct is_error : std::false_type {};
+            template <typename... Enums> struct is_error<Error<Enums...>> : std::true_type {};
+
+            // SafeInt, WrapInt, SatInt and friends format as their raw value.
+            template <typename T, typename = void>
+            struct has_raw : std::false_type {};
+
+            template <typename T>
+            struct has_raw<T, std::enable_if_t<std::is_integral_v<decltype(std::declval<const T&>().raw())>>>
+                : std::true_type {};
+
+            template <typename T, typename W, typename = void>
+            struct has_format_method : std::false_type {};
+
+            template <typename T, typename W>
+            struct has_format_method<T, W, std::enable_if_t<std::is_same_v<
+                decltype(std::declval<const T&>().format(std::declval<W&>())), Error<WriteError>>>>
+                : std::true_type {};
+
+            template <typename T>
+            constexpr bool is_char_v = std::is_same_v<std::remove_cv_t<T>, char>;
+
+            template <typename T>
+            constexpr bool is_byte_v = is_char_v<T> || std::is_same_v<std::remove_cv_t<T>, u8>
+                || std::is_same_v<std::remove_cv_t<T>, std::uint8_t>;
+
+            template <typename T>
+            constexpr bool is_cstring_v = (std::is_pointer_v<T> && is_char_v<std::remove_pointer_t<T>>)
+                || (std::is_array_v<T> && is_char_v<std::remove_extent_t<T>>);
+
+            template <typename T>
+            constexpr bool is_integer_v = (std::is_integral_v<T> && !std::is_same_v<T, bool> && !is_char_v<T>)
+                || has_raw<T>::value;
+
+            template <typename T, typename W>
+            constexpr bool accepts(char spec) {
+                if constexpr (is_slice<T>::value) {
+                    using Item = std::remove_cv_t<typename is_slice<T>::Item>;
+                    return (spec == 's' && is_byte_v<Item>) || (spec != 's' && accepts<Item, W>(spec));
+                } else if constexpr (is_array<T>::value) {
+                    using Item = std::remove_cv_t<typename is_array<T>::Item>;
+                    return (spec == 's' && is_byte_v<Item>) || (spec != 's' && accepts<Item, W>(spec));
+                } else if constexpr (is_result<T>::value) {
+                    using Value = std::remove_cv_t<std::remove_reference_t<decltype(std::declval<T&>().value())>>;
+                    return accepts<Value, W>(spec);
+                } else if constexpr (is_cstring_v<T>) {
+                    return spec == 0 || spec == 's';
+                } else if constexpr (is_char_v<T>) {
+                    return spec == 0 || spec == 'c' || spec == 'd' || spec == 'x';
+                } else if constexpr (is_integer_v<T>) {
+                    return spec == 0 || spec == 'd' || spec == 'x' || (spec == 'c' && sizeof(T) == 1);
+                } else if constexpr (std::is_floating_point_v<T>) {
+                    return spec == 0 || spec == 'd' || spec == 'e';
+                } else if constexpr (std::is_pointer_v<T>) {
+                    return spec == 0 || spec == 'x';
+                } else if constexpr (std::is_same_v<T, bool> || is_error<T>::value || has_format_method<T, W>::value) {
+                    return spec == 0;
+                } else {
+                    return false;
+                }
+            }
+
+            template <typename W>
+            Error<WriteError> writeChars(W& writer, const char* chars, std::size_t len) {
+                if (len == 0) return {};
+                return writer.rawWrite(Slice<const u8>{MiPtr<const u8>(reinterpret_cast<const u8*>(chars)), len});
+            }
+
+            template <typename W, typename U>
+            Error<WriteError> writeUnsigned(W& writer, U value, unsigned base, bool negative) {
+                char buf[fmt::int_impl::maxDigits(sizeof(U))];
+                char* end = buf + sizeof(buf);
+                char* p = fmt::int_impl::formatUnsigned(end, value, base);
+                if (negative) *--p = '-';
+                return writeChars(writer, p, end - p);
+            }
+
+            template <char Spec, typename W, typename T>
+            Error<WriteError> writeInteger(W& writer, T value) {
+                using U = std::make_unsigned_t<T>;
+                if constexpr (Spec == 'c') {
+                    char c = static_cast<char>(value);
+                    return writeChars(writer, &c, 1);
+                } else if constexpr (Spec == 'x') {
+                    return writeUnsigned(writer, static_cast<U>(value), 16, false);
+                } else if constexpr (std::is_signed_v<T>) {
+                    bool negative = value < 0;
+                    U magnitude = negative ? U(0) - static_cast<U>(value) : static_cast<U>(value);
+                    return writeUnsigned(writer, magnitude, 10, negative);
+                } else {
+                    return writeUnsigned(writer, value, 10, false);
+                }
+            }
+
+            // Shortest round-trip digits through to_chars, which never looks
+            // at the locale.
+            template <char Spec, typename W, typename T>
+            Error<WriteError> writeFloat(W& writer, T value) {
+                char buf[512];
+                std::to_chars_result result;
+                if constexpr (Spec == 'e') {
+                    result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::scientific);
+                } else if constexpr (Spec == 'd') {
+                    result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed);
+                } else {
+                    result = std::to_chars(buf, buf + sizeof(buf), value);
+                }
+                if (result.ec != std::errc()) [[unlikely]] {
+                    return writeChars(writer, "?", 1);
+                }
+                return writeChars(writer, buf, result.ptr - buf);
+            }
+
+            template <char Spec, typename W, typename T>
+            Error<WriteError> writeValue(W& writer, const T& value);
+
+            template <char Spec, typename W, typename T>
+            Error<WriteError> writeItems(W& writer, const T* items, std::size_t len) {
+                if constexpr (Spec == 's') {
+                    return writeChars(writer, reinterpret_cast<const char*>(items), len);
+                } else {
+                    if (len == 0) return writeChars(writer, "{ }", 3);
+                    Error<WriteError> error = writeChars(writer, "{ ", 2);
+                    for (std::size_t i = 0; i < len && error.isEmpty(); i++) {
+                        if (i != 0) error = writeChars(writer, ", ", 2);
+                        if (error.isEmpty()) error = writeValue<Spec>(writer, items[i]);
+                    }
+                    if (error.hasError()) return error;
+                    return writeChars(writer, " }", 2);
+                }
+            }
+
+            template <typename W, typename E>
+            bool writeErrorIf(W& writer, bool matches, E error, Error<WriteError>& result) {
+                if (matches) {
+                    result = writeChars(writer, "error(", 6);
+                    if (result.isEmpty()) result = writeInteger<0>(writer, static_cast<std::underlying_type_t<E>>(error));
+                    if (result.isEmpty()) result = writeChars(writer, ")", 1);
+                }
+                return matches;
+            }
+
+            template <char Spec, typename W, typename T, typename... Enums>
+            Error<WriteError> writeResult(W& writer, const Result<T, Enums...>& value) {
+                if (value.hasValue()) {
+                    return writeValue<Spec>(writer, value.value());
+                }
+                Error<WriteError> result;
+                bool written = (writeErrorIf(writer, value.template hasError<Enums>(),
+                    value.template hasError<Enums>() ? value.template error<Enums>() : Enums{}, result) || ...);
+                if (!written) return writeChars(writer, "empty", 5);
+                return result;
+            }
+
+            template <typename W, typename... Enums>
+            Error<WriteError> writeError(W& writer, const Error<Enums...>& value) {
+                if (value.isEmpty()) return writeChars(writer, "ok", 2);
+                Error<WriteError> result;
+                (writeErrorIf(writer, value.template is<Enums>(),
+                    value.template is<Enums>() ? value.template get<Enums>() : Enums{}, result) || ...);
+                return result;
+            }
+
+            template <char Spec, typename W, typename T>
+            Error<WriteError> writeValue(W& writer, const T& value) {
+                if constexpr (is_slice<T>::value) {
+                    return writeItems<Spec>(writer, value.ptr.raw_ptr, value.len.raw());
+                } else if constexpr (is_array<T>::value) {
+                    return writeItems<Spec>(writer, value.items, T::len.raw());
+                } else if constexpr (is_result<T>::value) {
+                    return writeResult<Spec>(writer, value);
+                } else if constexpr (is_error<T>::value) {
+                    return writeError(writer, value);
+                } else if constexpr (is_cstring_v<T>) {
+                    if constexpr (std::is_array_v<T>) {
+                        return writeChars(writer, value, strnlen(value, std::extent_v<T>));
+                    } else {
+                        return writeChars(writer, value, std::strlen(value));
+                    }
+                } else if constexpr (is_char_v<T>) {
+                    if constexpr (Spec == 0 || Spec == 'c') {
+                        return writeChars(writer, &value, 1);
+                    } else {
+                        return writeInteger<Spec>(writer, static_cast<unsigned char>(value));
+                    }
+                } else if constexpr (has_raw<T>::value) {
+                    return writeInteger<Spec>(writer, value.raw());
+                } else if constexpr (std::is_same_v<T, bool>) {
+                    return value ? writeChars(writer, "true", 4) : writeChars(writer, "false", 5);
+                } else if constexpr (std::is_integral_v<T>) {
+                    return writeInteger<Spec>(writer, value);
+                } else if constexpr (std::is_floating_point_v<T>) {
+                    return writeFloat<Spec>(writer, value);
+                } else if constexpr (std::is_pointer_v<T>) {
+                    Error<WriteError> error = writeChars(writer, "0x", 2);
+                    if (error.hasError()) return error;
+                    return writeInteger<'x'>(writer, reinterpret_cast<std::uintptr_t>(value));
+                } else {
+                    return value.format(writer);
+                }
+            }
+
+            template <typename F, std::size_t I, typename W, typename Tuple>
+            Error<WriteError> writePiece(W& writer, const Tuple& args) {
+                constexpr Piece piece = parsed_v<F>.pieces[I];
+                if constexpr (piece.kind == PieceKind::Literal) {
+                    return writeChars(writer, F::string() + piece.begin, piece.end - piece.begin);
+                } else {
+                    using Arg = std::remove_cv_t<std::remove_reference_t<std::tuple_element_t<piece.arg, Tuple>>>;
+                    static_assert(accepts<Arg, W>(piece.spec), "format spec does not apply to the argument type");
+                    return writeValue<piece.spec>(writer, std::get<piece.arg>(args));
+                }
+            }
+
+            template <typename F, typename W, typename Tuple, std::size_t... I>
+            Error<WriteError> writePieces(W& writer, const Tuple& args, std::index_sequence<I...>) {
+                Error<WriteError> result;
+                ((result = writePiece<F, I>(writer, args), result.isEmpty()) && ...);
+                return result;
+            }
+        }
+
+        // Formats `args` into `writer` (anything with a
+        // `rawWrite(Slice<const u8>) -> Error<WriteError>`) with no
+        // intermediate allocations. Types not covered above can provide
+        // `Error<WriteError> format(W&) const`.
+        template <typename W, typename F, typename... Args>
+        Error<WriteError> format(W& writer, F, const Args&... args) {
+            constexpr auto& parsed = fmt_impl::parsed_v<F>;
+            static_assert(parsed.status != fmt_impl::Status::UnclosedBrace, "format string has an unclosed '{'");
+            static_assert(parsed.status != fmt_impl::Status::UnmatchedBrace, "format string has an unmatched '}', use '}}'");
+            static_assert(parsed.status != fmt_impl::Status::BadSpec, "format spec must be one of d, x, e, s, c");
+            static_assert(parsed.status != fmt_impl::Status::Ok || parsed.args == sizeof...(Args),
+                "format string placeholder count does not match the argument count");
+            if constexpr (parsed.status == fmt_impl::Status::Ok && parsed.args == sizeof...(Args)) {
+                return fmt_impl::writePieces<F>(writer, std::forward_as_tuple(args...), std::make_index_sequence<parsed.count>{});
+            } else {
+                return {};
+            }
+        }
+
+        // Helpers shared by the type-erased Writer and concrete writers, same
+        // pattern as heap::AllocatorMethods.
+        template <typename Self>
+        struct WriterMethods {
+            Error<WriteError> writeAll(Slice<const u8> bytes) {
+                return self().rawWrite(bytes);
+            }
+
+            Error<WriteError> writeByte(u8 byte) {
+                return self().rawWrite(Slice<const u8>{MiPtr<const u8>(&byte), 1});
+            }
+
+            template <typename F, typename... Args>
+            Error<WriteError> print(F fmt, const Args&... args) {
+                return format(self(), fmt, args...);
+            }
+
+        private:
+            Self& self() {
+                return static_cast<Self&>(*this);
+            }
+        };
+
+        struct WriterVTable {
+            /// Write all of `bytes`. On error a prefix of `bytes` may have
+            /// been written.
+            ///
+            Ptr<Error<WriteError>(void* ctx, Slice<const u8> bytes)> write;
+
+            /// Push buffered bytes to the underlying sink.
+            ///
+            Ptr<Error<WriteError>(void* ctx)> flush;
+        };
+
+        // Writer interface
+        struct Writer : WriterMethods<Writer> {
+            void* impl_data;
+            const WriterVTable* vtable;
+
+            Error<WriteError> rawWrite(Slice<const u8> bytes) const {
+                return vtable->write(impl_data, bytes);
+            }
+
+            Error<WriteError> flush() const {
+                return vtable->flush(impl_data);
+            }
+        };
+
+        namespace writer_impl {
+            template <typename W>
+            Error<WriteError> vtableWrite(void* ctx, Slice<const u8> bytes) {
+                return static_cast<W*>(ctx)->rawWrite(bytes);
+            }
+
+            template <typename W>
+            Error<WriteError> vtableFlush(void* ctx) {
+                return static_cast<W*>(ctx)->flush();
+            }
+
+            template <typename W>
+            inline const WriterVTable vtable = {
+                vtableWrite<W>,
+                vtableFlush<W>
+            };
+
+            // `written` is the number of bytes written before an error.
+            inline Error<WriteError> writeFd(int fd, const std::uint8_t* bytes, std::size_t len, std::size_t& written) {
+                written = 0;
+#if __has_include(<unistd.h>)
+                while (len > 0) {
+                    ssize_t count = ::write(fd, bytes, len);
+                    if (count < 0) {
+                        switch (errno) {
+                            case EINTR: continue;
+                            case EPIPE: return WriteError::BrokenPipe;
+                            case ENOSPC: return WriteError::NoSpaceLeft;
+                            case EDQUOT: return WriteError::DiskQuota;
+                            case EAGAIN: return WriteError::WouldBlock;
+                            default: return WriteError::InputOutput;
+                        }
+                    }
+                    bytes += count;
+                    len -= static_cast<std::size_t>(count);
+                    written += static_cast<std::size_t>(count);
+                }
+                return {};
+#else
+                std::FILE* file = fd == 2 ? stderr : stdout;
+                written = std::fwrite(bytes, 1, len, file);
+                if (written != len) {
+                    return WriteError::InputOutput;
+                }
+                return {};
+#endif
+            }
+
+            inline Error<WriteError> writeFd(int fd, const std::uint8_t* bytes, std::size_t len) {
+                std::size_t written;
+                return writeFd(fd, bytes, len, written);
+            }
+        }
+
+        // Writes into a caller-provided buffer, fails with NoSpaceLeft after
+        // filling it.
+        struct FixedBufferWriter : WriterMethods<FixedBufferWriter> {
+            Slice<u8> buffer;
+            usize pos;
+
+            static FixedBufferWriter init(Slice<u8> buffer) {
+                return {{}, buffer, 0};
+            }
+
+            Slice<u8> getWritten() const {
+                return buffer.slice(0, pos);
+            }
+
+            void reset() {
+                pos = 0;
+            }
+
+            Error<WriteError> rawWrite(Slice<const u8> bytes) {
+                std::size_t available = (buffer.len - pos).raw();
+                std::size_t count = std::min(available, bytes.len.raw());
+                if (count > 0) {
+                    std::memcpy(buffer.ptr.raw_ptr + pos.raw(), bytes.ptr.raw_ptr, count);
+                    pos += count;
+                }
+                if (count < bytes.len) {
+                    return WriteError::NoSpaceLeft;
+                }
+                return {};
+            }
+
+            Error<WriteError> flush() {
+                return {};
+            }
+
+            Writer writer() {
+                return {{}, this, &writer_impl::vtable<FixedBufferWriter>};
+            }
+        };
+
+        // Buffers writes to a file descriptor in `N` bytes of inline storage.
+        // Nothing is written until the buffer fills or flush() is called.
+        // Bytes a failed flush could not write stay buffered, so flush can be
+        // retried, e.g. after WouldBlock.
+        template <std::size_t N = 4096>
+        struct BufferedFdWriter : WriterMethods<BufferedFdWriter<N>> {
+            int fd;
+            // buffer[start, end) is not written yet.
+            std::size_t start;
+            std::size_t end;
+            std::uint8_t buffer[N];
+
+            static BufferedFdWriter init(int fd) {
+                BufferedFdWriter self;
+                self.fd = fd;
+                self.start = 0;
+                self.end = 0;
+                return self;
+            }
+
+            Error<WriteError> rawWrite(Slice<const u8> bytes) {
+                const std::uint8_t* data = reinterpret_cast<const std::uint8_t*>(bytes.ptr.raw_ptr);
+                std::size_t len = bytes.len.raw();
+                if (len <= N - end) [[likely]] {
+                    if (len > 0) std::memcpy(buffer + end, data, len);
+                    end += len;
+                    return {};
+                }
+                Error<WriteError> error = flush();
+                if (error.hasError()) {
+                    return error;
+                }
+                if (len >= N) {
+                    return writer_impl::writeFd(fd, data, len);
+                }
+                std::memcpy(buffer, data, len);
+                end = len;
+                return {};
+            }
+
+            Error<WriteError> flush() {
+                std::size_t written;
+                Error<WriteError> error = writer_impl::writeFd(fd, buffer + start, end - start, written);
+                start += written;
+                if (error.hasError()) {
+                    return error;
+                }
+                start = 0;
+                end = 0;
+                return {};
+            }
+
+            Writer writer() {
+                return {{}, this, &writer_impl::vtable<BufferedFdWriter>};
+            }
+        };
+
+        // Appends to an ArrayList<u8>, only fails if allocation panics.
+        template <typename A = heap::Allocator>
+        struct ArrayListWriter : WriterMethods<ArrayListWriter<A>> {
+            ArrayList<u8, A>* list;
+            heap::AllocatorRef<A> allocator;
+
+            static ArrayListWriter init(ArrayList<u8, A>& list, heap::AllocatorRef<A> allocator) {
+                return {{}, &list, allocator};
+            }
+
+            Error<WriteError> rawWrite(Slice<const u8> bytes) {
+                list->appendSlice(allocator, bytes);
+                return {};
+            }
+
+            Error<WriteError> flush() {
+                return {};
+            }
+
+            Writer writer() {
+                return {{}, this, &writer_impl::vtable<ArrayListWriter>};
+            }
+        };
+
+        // Formats into `buffer` and returns the written part.
+        template <typename F, typename... Args>
+        Result<Slice<u8>, WriteError> bufPrint(Slice<u8> buffer, F fmt, const Args&... args) {
+            FixedBufferWriter writer = FixedBufferWriter::init(buffer);
+            Error<WriteError> error = format(writer, fmt, args...);
+            if (error.hasError()) {
+                return error.get<WriteError>();
+            }
+            return writer.getWritten();
+        }
+    }
+
+    // Formats to stdout through a 1024 byte buffer, so shorter output takes
+    // a single write and longer output one per filled buffer. Output is not
+    // ordered with text still sitting in the <cstdio> stdout buffer.
+    template <typename F, typename... Args>
+    void print(F fmt, const Args&... args) {
+        io::BufferedFdWriter<1024> out = io::BufferedFdWriter<1024>::init(1);
+        (void) io::format(out, fmt, args...);
+        (void) out.flush();
+    }
+
+    inline void println(const char* str) {
+        print(FMT("{s}\n"), str);
+    }
+}
+// ==== io
+
+// reader ====
+namespace stj {
+    namespace io {
+        enum class ReadError {
+            EndOfStream,
+            StreamTooLong,
+            WouldBlock,
+            InputOutput,
+            IsDir,
+            FileNotFound,
+            AccessDenied,
+        };
+
+        // Helpers shared by the type-erased Reader and concrete readers.
+        // `rawRead` returns how many bytes were read, 0 only at the end of
+        // the stream.
+        template <typename Self>
+        struct ReaderMethods {
+            Result<usize, ReadError> read(Slice<u8> buffer) {
+                return self().rawRead(buffer);
+            }
+
+            // Reads until `buffer` is full or the stream ends.
+            Result<usize, ReadError> readAll(Slice<u8> buffer) {
+                usize total = 0;
+                while (total < buffer.len) {
+                    usize count = TRY(self().rawRead(buffer.slice(total)));
+                    if (count == 0) break;
+                    total += count;
+                }
+                return total;
+            }
+
+            // Fills `buffer` or fails with EndOfStream.
+            Error<ReadError> readNoEof(Slice<u8> buffer) {
+                Result<usize, ReadError> count = readAll(buffer);
+                if (count.hasAnyError()) return count.template error<ReadError>();
+                if (count.value() < buffer.len) return ReadError::EndOfStream;
+                return {};
+            }
+
+            Result<u8, ReadError> readByte() {
+                u8 byte = 0;
+                Result<usize, ReadError> count = self().rawRead(Slice<u8>{MiPtr<u8>(&byte), 1});
+                if (count.hasAnyError()) return count.template error<ReadError>();
+                if (count.value() == 0) return ReadError::EndOfStream;
+                return byte;
+            }
+
+        private:
+            Self& self() {
+                return static_cast<Self&>(*this);
+            }
+        };
+
+        struct ReaderVTable {
+            /// Read at most `buffer.len` bytes into `buffer` and return how
+            /// many were read. 0 means the end of the stream.
+            ///
+            Ptr<Result<usize, ReadError>(void* ctx, Slice<u8> buffer)> read;
+        };
+
+        // Reader interface
+        struct Reader : ReaderMethods<Reader> {
+            void* impl_data;
+            const ReaderVTable* vtable;
+
+            Result<usize, ReadError> rawRead(Slice<u8> buffer) const {
+                return vtable->read(impl_data, buffer);
+            }
+        };
+
+        namespace reader_impl {
+            template <typename R>
+            Result<usize, ReadError> vtableRead(void* ctx, Slice<u8> buffer) {
+                return static_cast<R*>(ctx)->rawRead(buffer);
+            }
+
+            template <typename R>
+            inline const ReaderVTable vtable = {
+                vtableRead<R>
+            };
+
+            inline Result<usize, ReadError> readFd(int fd, std::uint8_t* buffer, std::size_t len) {
+#if __has_include(<unistd.h>)
+                while (true) {
+                    ssize_t count = ::read(fd, buffer, len);
+                    if (count >= 0) {
+                        return usize(static_cast<std::size_t>(count));
+                    }
+                    switch (errno) {
+                        case EINTR: continue;
+                        case EAGAIN: return ReadError::WouldBlock;
+                        case EISDIR: return ReadError::IsDir;
+                        default: return ReadError::InputOutput;
+                    }
+                }
+#else
+                std::FILE* file = fd == 0 ? stdin : nullptr;
+                if (file == nullptr) return ReadError::InputOutput;
+                std::size_t count = std::fread(buffer, 1, len, file);
+                if (count == 0 && std::ferror(file)) return ReadError::InputOutput;
+                return usize(count);
+#endif
+            }
+
+            inline const std::uint8_t* findByte(const std::uint8_t* begin, const std::uint8_t* end, u8 byte) {
+                const std::uint8_t* found = mem::mem_impl::findByte(begin, end, byte.raw());
+                return found == nullptr ? end : found;
+            }
+
+            inline Slice<const u8> bytesOf(const std::uint8_t* begin, std::size_t len) {
+                if (len == 0) return Slice<const u8>::empty();
+                return Slice<const u8>{MiPtr<const u8>(reinterpret_cast<const u8*>(begin)), len};
+            }
+        }
+
+        // Reads from a slice that is already in memory.
+        struct FixedBufferReader : ReaderMethods<FixedBufferReader> {
+            Slice<const u8> buffer;
+            usize pos;
+
+            static FixedBufferReader init(Slice<const u8> buffer) {
+                return {{}, buffer, 0};
+            }
+
+            Result<usize, ReadError> rawRead(Slice<u8> dest) {
+                std::size_t count = std::min((buffer.len - pos).raw(), dest.len.raw());
+                if (count > 0) {
+                    std::memcpy(dest.ptr.raw_ptr, buffer.ptr.raw_ptr + pos.raw(), count);
+                    pos += count;
+                }
+                return usize(count);
+            }
+
+            // Returns the bytes up to `delimiter` as a slice of the source and
+            // consumes the delimiter. The last line does not need one.
+            Result<Slice<const u8>, ReadError> readUntilDelimiter(u8 delimiter) {
+                if (pos == buffer.len) {
+                    return ReadError::EndOfStream;
+                }
+                const std::uint8_t* begin = reinterpret_cast<const std::uint8_t*>(buffer.ptr.raw_ptr) + pos.raw();
+                const std::uint8_t* end = reinterpret_cast<const std::uint8_t*>(buffer.ptr.raw_ptr) + buffer.len.raw();
+                const std::uint8_t* found = reader_impl::findByte(begin, end, delimiter);
+                pos += static_cast<std::size_t>(found - begin) + (found != end);
+                return reader_impl::bytesOf(begin, found - begin);
+            }
+
+            Reader reader() {
+                return {{}, this, &reader_impl::vtable<FixedBufferReader>};
+            }
+        };
+
+        // Buffers reads from a file descriptor in `N` bytes of inline storage.
+        template <std::size_t N = 4096>
+        struct BufferedFdReader : ReaderMethods<BufferedFdReader<N>> {
+            int fd;
+            std::size_t start;
+            std::size_t end;
+            std::uint8_t buffer[N];
+
+            static BufferedFdReader init(int fd) {
+                BufferedFdReader self;
+                self.fd = fd;
+                self.start = 0;
+                self.end = 0;
+                return self;
+            }
+
+            Result<usize, ReadError> rawRead(Slice<u8> dest) {
+                std::uint8_t* out = reinterpret_cast<std::uint8_t*>(dest.ptr.raw_ptr);
+                std::size_t len = dest.len.raw();
+                if (start == end) {
+                    // Large reads skip the buffer.
+                    if (len >= N) {
+                        return reader_impl::readFd(fd, out, len);
+                    }
+                    start = 0;
+                    end = TRY(reader_impl::readFd(fd, buffer, N)).raw();
+                }
+                std::size_t count = std::min(len, end - start);
+                if (count > 0) {
+                    std::memcpy(out, buffer + start, count);
+                    start += count;
+                }
+                return usize(count);
+            }
+
+            // Returns the bytes up to `delimiter` as a slice of the internal
+            // buffer, valid until the next read, and consumes the delimiter.
+            // Fails with StreamTooLong when no delimiter shows up within N
+            // bytes; the last line does not need one.
+            Result<Slice<const u8>, ReadError> readUntilDelimiter(u8 delimiter) {
+                std::size_t scanned = start;
+                while (true) {
+                    const std::uint8_t* found = reader_impl::findByte(buffer + scanned, buffer + end, delimiter);
+                    if (found != buffer + end) {
+                        std::size_t line_start = start;
+                        start = static_cast<std::size_t>(found - buffer) + 1;
+                        return reader_impl::bytesOf(buffer + line_start, found - (buffer + line_start));
+                    }
+
+                    if (start > 0) {
+                        std::memmove(buffer, buffer + start, end - start);
+                        end -= start;
+                        start = 0;
+                    }
+                    if (end == N) {
+                        return ReadError::StreamTooLong;
+                    }
+                    scanned = end;
+                    Result<usize, ReadError> read = reader_impl::readFd(fd, buffer + end, N - end);
+                    if (read.hasAnyError()) {
+                        return read.template error<ReadError>();
+                    }
+                    std::size_t count = read.value().raw();
+                    if (count == 0) {
+                        if (end == 0) {
+                            return ReadError::EndOfStream;
+                        }
+                        std::size_t line_len = end;
+                        start = end = 0;
+                        return reader_impl::bytesOf(buffer, line_len);
+                    }
+                    end += count;
+                }
+            }
+
+            Reader reader() {
+                return {{}, this, &reader_impl::vtable<BufferedFdReader>};
+            }
+        };
+
+#if __has_include(<sys/mman.h>)
+        // Read-only mapping of a whole file. `bytes` is valid until close().
+        struct MappedFile {
+            Slice<const u8> bytes;
+
+            // Maps `path` and hints the kernel that it will be read front to
+            // back soon, so readahead starts before the first page fault.
+            static Result<MappedFile, ReadError> open(const char* path) {
+                int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    switch (errno) {
+                        case ENOENT: return ReadError::FileNotFound;
+                        case EACCES: return ReadError::AccessDenied;
+                        case EISDIR: return ReadError::IsDir;
+                        default: return ReadError::InputOutput;
+                    }
+                }
+                defer (::close(fd));
+
+                struct stat info;
+                if (::fstat(fd, &info) != 0) {
+                    return ReadError::InputOutput;
+                }
+                if (S_ISDIR(info.st_mode)) {
+                    return ReadError::IsDir;
+                }
+                std::size_t size = static_cast<std::size_t>(info.st_size);
+                if (size == 0) {
+                    return MappedFile{Slice<const u8>::empty()};
+                }
+
+                void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) {
+                    return ReadError::InputOutput;
+                }
+                (void) ::madvise(data, size, MADV_SEQUENTIAL);
+                (void) ::madvise(data, size, MADV_WILLNEED);
+                return MappedFile{Slice<const u8>{MiPtr<const u8>(static_cast<const u8*>(data)), size}};
+            }
+
+            void close() {
+                if (bytes.len == 0) {
+                    return;
+                }
+                ::munmap(const_cast<u8*>(bytes.ptr.raw_ptr), bytes.len.raw());
+                bytes = Slice<const u8>::empty();
+            }
+
+            FixedBufferReader reader() const {
+                return FixedBufferReader::init(bytes);
+            }
+        };
+#endif
+    }
+}
+// ==== reader
+
+// serialization ====
+namespace stj {
+    namespace serial {
+        enum class DecodeError {
+            Truncated,
+            BadMagic,
+            UnsupportedVersion,
+            EndianMismatch,
+            TypeMismatch,
+            Misaligned,
+            LengthOverflow,
+        };
+
+        // Every block starts with this header, native endian, and is padded
+        // to a multiple of block_alignment so blocks can follow each other.
+        // The items start at the first multiple of their alignment after
+        // the header.
+        struct BlockHeader {
+            std::uint32_t magic;
+            std::uint8_t version;
+            std::uint8_t endian;
+            std::uint16_t item_align;
+            std::uint32_t item_size;
+            std::uint32_t reserved;
+            std::uint64_t type_hash;
+            std::uint64_t count;
+        };
+        static_assert(sizeof(BlockHeader) == 32, "BlockHeader layout must not change");
+
+        constexpr std::uint32_t block_magic = 0x424a5453; // "STJB"
+        constexpr std::uint8_t block_version = 1;
+        constexpr std::size_t block_alignment = 32;
+
+        namespace serial_impl {
+            constexpr std::uint8_t little_endian = 1;
+            constexpr std::uint8_t big_endian = 2;
+            constexpr std::uint8_t native_endian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? little_endian : big_endian;
+
+            constexpr std::uint64_t fnv1a(const char* text) {
+                std::uint64_t hash = 0xcbf29ce484222325;
+                for (; *text != 0; text++) {
+                    hash ^= static_cast<unsigned char>(*text);
+                    hash *= 0x100000001b3;
+                }
+                return hash;
+            }
+
+            // Seeds the default type id so it is not just size and alignment.
+            constexpr std::uint64_t layout_seed = fnv1a("stj.serial.layout");
+
+            template <typename T, typename = void>
+            struct HasTypeId : std::false_type {};
+
+            template <typename T>
+            struct HasTypeId<T, std::void_t<decltype(T::serial_type_id)>> : std::true_type {};
+
+            constexpr std::size_t alignUp(std::size_t value, std::size_t alignment) {
+                return (value + alignment - 1) & ~(alignment - 1);
+            }
+
+            template <typename T>
+            constexpr std::size_t payload_offset = alignUp(sizeof(BlockHeader), alignof(T));
+
+            inline Slice<const u8> bytesOf(const void* data, std::size_t len) {
+                return Slice<const u8>{MiPtr<const u8>(static_cast<const u8*>(data)), len};
+            }
+
+            inline const std::uint8_t zero_padding[block_alignment > 64 ? block_alignment : 64] = {};
+        }
+
+        // Identifies T in block headers. The default depends only on the
+        // size and alignment of T, so it is the same for every compiler but
+        // any type with the same layout passes the check. Give T a `static
+        // constexpr std::uint64_t serial_type_id` member for a strict check,
+        // and change it when the layout or meaning of T changes.
+        template <typename T>
+        constexpr std::uint64_t typeHash() {
+            if constexpr (serial_impl::HasTypeId<T>::value) {
+                return T::serial_type_id;
+            } else {
+                return serial_impl::layout_seed ^ (std::uint64_t(sizeof(T)) << 32) ^ alignof(T);
+            }
+        }
+
+        // Bytes written by writeSlice for `count` items.
+        template <typename T>
+        usize encodedSize(usize count) {
+            return serial_impl::alignUp((count * sizeof(T) + serial_impl::payload_offset<T>).raw(), block_alignment);
+        }
+
+        // Writes the items as one block: header, padding, the raw bytes of
+        // all items in a single write, padding.
+        template <typename T, typename W>
+        Error<io::WriteError> writeSlice(W& writer, Slice<const T> items) {
+            static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable items can be serialized");
+            static_assert(alignof(T) <= block_alignment, "item alignment is greater than the block alignment");
+
+            BlockHeader header{};
+            header.magic = block_magic;
+            header.version = block_version;
+            header.endian = serial_impl::native_endian;
+            header.item_align = static_cast<std::uint16_t>(alignof(T));
+            header.item_size = static_cast<std::uint32_t>(sizeof(T));
+            header.type_hash = typeHash<T>();
+            header.count = items.len.raw();
+
+            std::size_t payload_len = (items.len * sizeof(T)).raw();
+            std::size_t head_padding = serial_impl::payload_offset<T> - sizeof(BlockHeader);
+            std::size_t tail_padding = encodedSize<T>(items.len).raw() - serial_impl::payload_offset<T> - payload_len;
+
+            TRY(writer.writeAll(serial_impl::bytesOf(&header, sizeof(header))));
+            if (head_padding > 0) {
+                TRY(writer.writeAll(serial_impl::bytesOf(serial_impl::zero_padding, head_padding)));
+            }
+            if (payload_len > 0) {
+                TRY(writer.writeAll(serial_impl::bytesOf(items.ptr.raw_ptr, payload_len)));
+            }
+            if (tail_padding > 0) {
+                TRY(writer.writeAll(serial_impl::bytesOf(serial_impl::zero_padding, tail_padding)));
+            }
+            return {};
+        }
+
+        template <typename T, typename W>
+        Error<io::WriteError> writeSlice(W& writer, Slice<T> items) {
+            return writeSlice<T>(writer, static_cast<Slice<const T>>(items));
+        }
+
+        template <typename T, typename A, typename W>
+        Error<io::WriteError> writeList(W& writer, const ArrayList<T, A>& list) {
+            return writeSlice(writer, list.items);
+        }
+
+        // An aggregate is written as a block of one item.
+        template <typename T, typename W>
+        Error<io::WriteError> writeValue(W& writer, const T& value) {
+            return writeSlice(writer, Slice<const T>{MiPtr<const T>(&value), 1});
+        }
+
+        // Items of one block, pointing into the decoded buffer, and the
+        // bytes after the block.
+        template <typename T>
+        struct View {
+            Slice<const T> items;
+            Slice<const u8> rest;
+        };
+
+        // Validates the block at the start of `bytes` and returns its items
+        // without copying, e.g. straight out of a MappedFile. The buffer
+        // must outlive the view and start at an address aligned like T,
+        // which mmap and the heap allocators guarantee.
+        template <typename T>
+        Result<View<T>, DecodeError> view(Slice<const u8> bytes) {
+            static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable items can be deserialized");
+
+            if (bytes.len < sizeof(BlockHeader)) {
+                return DecodeError::Truncated;
+            }
+            BlockHeader header;
+            std::memcpy(&header, bytes.ptr.raw_ptr, sizeof(header));
+            if (header.magic != block_magic) {
+                return DecodeError::BadMagic;
+            }
+            if (header.version != block_version) {
+                return DecodeError::UnsupportedVersion;
+            }
+            if (header.endian != serial_impl::native_endian) {
+                return DecodeError::EndianMismatch;
+            }
+            if (header.type_hash != typeHash<T>() || header.item_size != sizeof(T) || header.item_align != alignof(T)) {
+                return DecodeError::TypeMismatch;
+            }
+
+            // The count comes from the input, so the size is computed without
+            // panicking and checked once.
+            DeferredInt<std::uint64_t> payload_end = u64(header.count).deferred() * u64(sizeof(T)) + u64(serial_impl::payload_offset<T>);
+            DeferredInt<std::uint64_t> block_end = payload_end + u64(block_alignment - 1);
+            if (payload_end.overflowed() || block_end.overflowed()) {
+                return DecodeError::LengthOverflow;
+            }
+            std::uint64_t payload_bytes = SafeInt<std::uint64_t>(payload_end).raw();
+            std::uint64_t block_bytes = SafeInt<std::uint64_t>(block_end).raw() & ~std::uint64_t(block_alignment - 1);
+            if (payload_bytes > bytes.len.raw()) {
+                return DecodeError::Truncated;
+            }
+
+            const u8* payload = bytes.ptr.raw_ptr + serial_impl::payload_offset<T>;
+            if (reinterpret_cast<std::uintptr_t>(payload) % alignof(T) != 0) {
+                return DecodeError::Misaligned;
+            }
+
+            View<T> result{Slice<const T>::empty(), Slice<const u8>::empty()};
+            if (header.count > 0) {
+                result.items = Slice<const T>{MiPtr<const T>(reinterpret_cast<const T*>(payload)), static_cast<std::size_t>(header.count)};
+            }
+            // The last block of a buffer may lack its tail padding.
+            std::size_t consumed = block_bytes < bytes.len.raw() ? static_cast<std::size_t>(block_bytes) : bytes.len.raw();
+            result.rest = bytes.slice(consumed);
+            return result;
+        }
+
+        // Appends the items of the block at the start of `bytes` to `list`
+        // with one copy and returns the bytes after the block.
+        template <typename T, typename A>
+        Result<Slice<const u8>, DecodeError> readList(ArrayList<T, A>& list, heap::AllocatorRef<A> alloc, Slice<const u8> bytes) {
+            Result<View<T>, DecodeError> block = view<T>(bytes);
+            if (block.hasAnyError()) return block.template error<DecodeError>();
+            list.appendSlice(alloc, block.value().items);
+            return block.value().rest;
+        }
+
+        // Copies the single item of a block written by writeValue.
+        template <typename T>
+        Result<T, DecodeError> readValue(Slice<const u8> bytes) {
+            Result<View<T>, DecodeError> block = view<T>(bytes);
+            if (block.hasAnyError()) return block.template error<DecodeError>();
+            if (block.value().items.len != 1) return DecodeError::TypeMismatch;
+            return block.value().items.ptr.raw_ptr[0];
+        }
+    }
+}
+// ==== serialization
+
+// event loop ====
+#if __has_include(<linux/io_uring.h>) && __has_include(<sys/epoll.h>) && __has_include(<sys/mman.h>)
+namespace stj {
+    namespace io {
+        enum class IoError {
+            WouldBlock,
+            Canceled,
+            BrokenPipe,
+            ConnectionReset,
+            ConnectionRefused,
+            AccessDenied,
+            BadFileDescriptor,
+            InvalidArgument,
+            SystemResources,
+            Unsupported,
+            InputOutput,
+        };
+
+        struct EventLoop;
+        struct Completion;
+
+        // Reads and writes report the byte count, accept the new descriptor
+        // and an expired timeout 0.
+        using IoCallback = void (*)(EventLoop& loop, Completion& completion, Result<usize, IoError> result);
+
+        // One in-flight operation. The caller owns it and keeps it alive and
+        // untouched until its callback runs, the callback may reuse it.
+        struct Completion {
+            enum class Op : std::uint8_t {
+                Read,
+                Write,
+                ReadFixed,
+                WriteFixed,
+                Accept,
+                Timeout,
+            };
+
+            IoCallback callback = nullptr;
+            void* context = nullptr;
+            Completion* next = nullptr;
+            Op op = Op::Read;
+            int fd = -1;
+            std::uint8_t* buffer = nullptr;
+            std::size_t len = 0;
+            std::uint64_t offset = 0;
+            std::uint16_t buffer_index = 0;
+            // Raw result, a count or a negated errno as in an io_uring CQE.
+            int result = 0;
+            // io_uring reads the timespec after submission, so it lives here.
+            __kernel_timespec timeout{};
+            std::int64_t deadline_ns = 0;
+        };
+
+        namespace loop_impl {
+            // Intrusive FIFO threaded through Completion::next.
+            struct CompletionList {
+                Completion* head = nullptr;
+                Completion* tail = nullptr;
+
+                void push(Completion* completion) {
+                    completion->next = nullptr;
+                    if (tail == nullptr) {
+                        head = completion;
+                    } else {
+                        tail->next = completion;
+                    }
+                    tail = completion;
+                }
+
+                Completion* pop() {
+                    Completion* completion = head;
+                    if (completion != nullptr) {
+                        head = completion->next;
+                        if (head == nullptr) tail = nullptr;
+                        completion->next = nullptr;
+                    }
+                    return completion;
+                }
+
+                bool isEmpty() const {
+                    return head == nullptr;
+                }
+            };
+
+            inline IoError errorFromErrno(int err) {
+                switch (err) {
+                    case EAGAIN: return IoError::WouldBlock;
+                    case EINTR:
+                    case ECANCELED: return IoError::Canceled;
+                    case EPIPE: return IoError::BrokenPipe;
+                    case ECONNRESET: return IoError::ConnectionReset;
+                    case ECONNREFUSED: return IoError::ConnectionRefused;
+                    case EACCES:
+                    case EPERM: return IoError::AccessDenied;
+                    case EBADF: return IoError::BadFileDescriptor;
+                    case EINVAL: return IoError::InvalidArgument;
+                    case ENOMEM:
+                    case ENOBUFS:
+                    case EMFILE:
+                    case ENFILE: return IoError::SystemResources;
+                    case ENOSYS:
+                    case EOPNOTSUPP: return IoError::Unsupported;
+                    default: return IoError::InputOutput;
+                }
+            }
+
+            inline std::int64_t monotonicNs() {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+            }
+
+            // glibc has no wrappers for the io_uring syscalls.
+            inline int uringSetup(unsigned entries, io_uring_params* params) {
+                return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+            }
+
+            inline int uringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+                return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+            }
+
+            inline int uringRegister(int fd, unsigned opcode, const void* arg, unsigned count) {
+                return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+            }
+
+            // Views into the rings shared with the kernel.
+            struct Ring {
+                unsigned* sq_head = nullptr;
+                unsigned* sq_tail = nullptr;
+                unsigned sq_mask = 0;
+                unsigned sq_entries = 0;
+                io_uring_sqe* sqes = nullptr;
+                unsigned* cq_head = nullptr;
+                unsigned* cq_tail = nullptr;
+                unsigned cq_mask = 0;
+                io_uring_cqe* cqes = nullptr;
+
+                // Our tail, published to the kernel on submission.
+                unsigned sq_local_tail = 0;
+                unsigned to_submit = 0;
+
+                void* sq_map = nullptr;
+                std::size_t sq_map_len = 0;
+                void* cq_map = nullptr;
+                std::size_t cq_map_len = 0;
+                std::size_t sqes_len = 0;
+            };
+
+            // Linux moves at most this many bytes per read or write (MAX_RW_COUNT).
+            // Longer buffers are cut to it, so counts fit in sqe->len and in
+            // Completion::result.
+            constexpr std::size_t max_rw_count = 0x7ffff000;
+
+            inline std::uint32_t epollEventsFor(const Completion& completion) {
+                switch (completion.op) {
+                    case Completion::Op::Write:
+                    case Completion::Op::WriteFixed: return EPOLLOUT;
+                    case Completion::Op::Timeout: return 0;
+                    default: return EPOLLIN;
+                }
+            }
+        }
+
+        // Single-threaded completion-based event loop. Operations are only
+        // queued when started and go to the kernel together on the next
+        // tick, runOnce or run, which also run the callbacks of finished
+        // operations in completion order. Callbacks may start new operations.
+        //
+        // The io_uring backend submits every queued operation with one
+        // io_uring_enter. The epoll backend, used when io_uring is missing
+        // or disabled, waits for readiness and then does the plain syscall.
+        // Regular files are always ready there, so their reads and writes
+        // run synchronously, and large writes to blocking pipes or sockets
+        // may block the loop: make those descriptors non-blocking. Each
+        // readiness event performs at most one read or accept and one write
+        // on the descriptor, the others wait for the next event.
+        //
+        // Like read(2) and write(2), an operation transfers at most
+        // 0x7ffff000 bytes and reports how many it did.
+        struct EventLoop {
+            enum class Backend : std::uint8_t {
+                IoUring,
+                Epoll,
+            };
+
+            // Offset for pipes and sockets, or to use and advance the file position.
+            static constexpr std::uint64_t stream_offset = ~std::uint64_t(0);
+
+            Backend backend = Backend::Epoll;
+            int fd = -1;
+            loop_impl::Ring ring{};
+            // io_uring: waiting for a free SQE. epoll: not started yet.
+            loop_impl::CompletionList unqueued{};
+            // epoll: waiting for readiness or a deadline.
+            loop_impl::CompletionList waiting{};
+            loop_impl::CompletionList completed{};
+            std::size_t active = 0;
+
+            heap::Allocator fixed_allocator{};
+            Slice<u8> fixed_buffers = Slice<u8>::empty();
+            std::size_t fixed_buffer_size = 0;
+
+            // io_uring when the kernel allows it, epoll otherwise.
+            static Result<EventLoop, IoError> init(u32 entries) {
+                Result<EventLoop, IoError> uring = initIoUring(entries);
+                if (uring.hasValue()) {
+                    return uring;
+                }
+                IoError error = uring.template error<IoError>();
+                if (error != IoError::Unsupported && error != IoError::AccessDenied) {
+                    return error;
+                }
+                return initEpoll();
+            }
+
+            // `entries` is the submission queue size, rounded up to a power
+            // of two by the kernel. Needs Linux 5.7 for fast poll.
+            static Result<EventLoop, IoError> initIoUring(u32 entries) {
+                io_uring_params params;
+                std::memset(&params, 0, sizeof(params));
+                int ring_fd = loop_impl::uringSetup(entries.raw(), &params);
+                if (ring_fd < 0) {
+                    return loop_impl::errorFromErrno(errno);
+                }
+
+                EventLoop self;
+                self.backend = Backend::IoUring;
+                self.fd = ring_fd;
+                if ((params.features & IORING_FEAT_FAST_POLL) == 0) {
+                    self.deinit();
+                    return IoError::Unsupported;
+                }
+
+                loop_impl::Ring& ring = self.ring;
+                ring.sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                ring.cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+                if (single_map) {
+                    ring.sq_map_len = std::max(ring.sq_map_len, ring.cq_map_len);
+                }
+
+                void* sq_map = ::mmap(nullptr, ring.sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+                if (sq_map == MAP_FAILED) {
+                    self.deinit();
+                    return IoError::SystemResources;
+                }
+                ring.sq_map = sq_map;
+                if (single_map) {
+                    ring.cq_map = sq_map;
+                } else {
+                    void* cq_map = ::mmap(nullptr, ring.cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+                    if (cq_map == MAP_FAILED) {
+                        self.deinit();
+                        return IoError::SystemResources;
+                    }
+                    ring.cq_map = cq_map;
+                }
+                ring.sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+                void* sqes = ::mmap(nullptr, ring.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+                if (sqes == MAP_FAILED) {
+                    ring.sqes_len = 0;
+                    self.deinit();
+                    return IoError::SystemResources;
+                }
+
+                char* sq = static_cast<char*>(ring.sq_map);
+                char* cq = static_cast<char*>(ring.cq_map);
+                ring.sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+                ring.sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                ring.sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                ring.sq_entries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+                ring.sqes = static_cast<io_uring_sqe*>(sqes);
+                ring.cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                ring.cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                ring.cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+                ring.cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+                ring.sq_local_tail = *ring.sq_tail;
+
+                // SQE slots are used in ring order, so the indirection array is
+                // the identity.
+                unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+                for (unsigned i = 0; i < ring.sq_entries; i++) {
+                    array[i] = i;
+                }
+                return self;
+            }
+
+            static Result<EventLoop, IoError> initEpoll() {
+                int epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+                if (epoll_fd < 0) {
+                    return loop_impl::errorFromErrno(errno);
+                }
+                EventLoop self;
+                self.backend = Backend::Epoll;
+                self.fd = epoll_fd;
+                return self;
+            }
+
+            // Operations still in flight are abandoned without callbacks.
+            void deinit() {
+                if (backend == Backend::IoUring) {
+                    if (ring.sqes_len != 0) ::munmap(ring.sqes, ring.sqes_len);
+                    if (ring.cq_map != nullptr && ring.cq_map != ring.sq_map) ::munmap(ring.cq_map, ring.cq_map_len);
+                    if (ring.sq_map != nullptr) ::munmap(ring.sq_map, ring.sq_map_len);
+                    ring = loop_impl::Ring{};
+                }
+                if (fd >= 0) {
+                    ::close(fd);
+                    fd = -1;
+                }
+                if (fixed_buffers.len != 0) {
+                    fixed_allocator.free(fixed_buffers);
+                    fixed_buffers = Slice<u8>::empty();
+                }
+            }
+
+            // Allocates `count` buffers of `size` bytes and, with io_uring,
+            // pins and registers them with the kernel so readFixed and
+            // writeFixed skip the per-operation page mapping. Fails with
+            // SystemResources when the memlock limit is too low.
+            Error<IoError> registerBuffers(heap::Allocator allocator, usize count, usize size) {
+                if (fixed_buffers.len != 0) [[unlikely]] {
+                    PANIC("fixed buffers are already registered");
+                }
+                Result<Slice<u8>, heap::AllocError> buffers = heap::typed::tryAlloc<u8>(allocator, count * size);
+                if (buffers.hasAnyError()) {
+                    return IoError::SystemResources;
+                }
+
+                if (backend == Backend::IoUring) {
+                    Result<Slice<iovec>, heap::AllocError> vecs = heap::typed::tryAlloc<iovec>(allocator, count);
+                    if (vecs.hasAnyError()) {
+                        allocator.free(buffers.value());
+                        return IoError::SystemResources;
+                    }
+                    defer (allocator.free(vecs.value()));
+                    for (usize i = 0; i < count; i++) {
+                        vecs.value().ptr.raw_ptr[i.raw()] = iovec{buffers.value().ptr.raw_ptr + (i * size).raw(), size.raw()};
+                    }
+                    if (loop_impl::uringRegister(fd, IORING_REGISTER_BUFFERS, vecs.value().ptr.raw_ptr, static_cast<unsigned>(count.raw())) < 0) {
+                        int err = errno;
+                        allocator.free(buffers.value());
+                        return loop_impl::errorFromErrno(err);
+                    }
+                }
+
+                fixed_allocator = allocator;
+                fixed_buffers = buffers.value();
+                fixed_buffer_size = size.raw();
+                return {};
+            }
+
+            Slice<u8> fixedBuffer(usize index) const {
+                return fixed_buffers.slice(index * fixed_buffer_size, (index + 1) * fixed_buffer_size);
+            }
+
+            void read(Completion& completion, int file, Slice<u8> buffer, IoCallback callback, void* context, std::uint64_t offset = stream_offset) {
+                prepare(completion, Completion::Op::Read, file, callback, context);
+                completion.buffer = reinterpret_cast<std::uint8_t*>(buffer.ptr.raw_ptr);
+                completion.len = std::min(buffer.len.raw(), loop_impl::max_rw_count);
+                completion.offset = offset;
+                enqueue(completion);
+            }
+
+            void write(Completion& completion, int file, Slice<const u8> buffer, IoCallback callback, void* context, std::uint64_t offset = stream_offset) {
+                prepare(completion, Completion::Op::Write, file, callback, context);
+                completion.buffer = const_cast<std::uint8_t*>(reinterpret_cast<const std::uint8_t*>(buffer.ptr.raw_ptr));
+                completion.len = std::min(buffer.len.raw(), loop_impl::max_rw_count);
+                completion.offset = offset;
+                enqueue(completion);
+            }
+
+            // Reads at most `len` bytes into fixedBuffer(buffer_index).
+            void readFixed(Completion& completion, int file, usize buffer_index, usize len, IoCallback callback, void* context, std::uint64_t offset = stream_offset) {
+                prepare(completion, Completion::Op::ReadFixed, file, callback, context);
+                setFixed(completion, buffer_index, len);
+                completion.offset = offset;
+                enqueue(completion);
+            }
+
+            // Writes the first `len` bytes of fixedBuffer(buffer_index).
+            void writeFixed(Completion& completion, int file, usize buffer_index, usize len, IoCallback callback, void* context, std::uint64_t offset = stream_offset) {
+                prepare(completion, Completion::Op::WriteFixed, file, callback, context);
+                setFixed(completion, buffer_index, len);
+                completion.offset = offset;
+                enqueue(completion);
+            }
+
+            // The accepted socket is close-on-exec.
+            void accept(Completion& completion, int socket, IoCallback callback, void* context) {
+                prepare(completion, Completion::Op::Accept, socket, callback, context);
+                enqueue(completion);
+            }
+
+            void timeout(Completion& completion, u64 nanoseconds, IoCallback callback, void* context) {
+                prepare(completion, Completion::Op::Timeout, -1, callback, context);
+                completion.timeout.tv_sec = static_cast<long long>(nanoseconds.raw() / 1000000000);
+                completion.timeout.tv_nsec = static_cast<long long>(nanoseconds.raw() % 1000000000);
+                completion.deadline_ns = static_cast<std::int64_t>(nanoseconds.raw());
+                enqueue(completion);
+            }
+
+            usize pending() const {
+                return active;
+            }
+
+            // Submits queued operations and runs the callbacks of those that
+            // already finished, without blocking.
+            Error<IoError> tick() {
+                return step(false);
+            }
+
+            // Like tick, but blocks until at least one operation finishes.
+            Error<IoError> runOnce() {
+                return step(true);
+            }
+
+            // Runs until no operations are left, including those started by
+            // callbacks.
+            Error<IoError> run() {
+                while (active > 0) {
+                    Error<IoError> error = step(true);
+                    if (error.hasError()) return error;
+                }
+                return {};
+            }
+
+        private:
+            void prepare(Completion& completion, Completion::Op op, int file, IoCallback callback, void* context) {
+                completion.op = op;
+                completion.fd = file;
+                completion.callback = callback;
+                completion.context = context;
+                completion.result = 0;
+            }
+
+            void setFixed(Completion& completion, usize buffer_index, usize len) {
+                Slice<u8> buffer = fixedBuffer(buffer_index);
+                if (len > buffer.len) [[unlikely]] {
+                    PANIC("length is greater than the fixed buffer");
+                }
+                completion.buffer = reinterpret_cast<std::uint8_t*>(buffer.ptr.raw_ptr);
+                completion.len = std::min(len.raw(), loop_impl::max_rw_count);
+                completion.buffer_index = static_cast<std::uint16_t>(buffer_index.raw());
+            }
+
+            void enqueue(Completion& completion) {
+                active++;
+                if (backend == Backend::IoUring && unqueued.isEmpty() && queueSqe(completion)) {
+                    return;
+                }
+                unqueued.push(&completion);
+            }
+
+            Error<IoError> step(bool wait) {
+                Error<IoError> error = backend == Backend::IoUring ? uringStep(wait) : epollStep(wait);
+                if (error.hasError()) return error;
+                runCompleted();
+                return {};
+            }
+
+            void runCompleted() {
+                loop_impl::CompletionList ready = completed;
+                completed = loop_impl::CompletionList{};
+                while (Completion* completion = ready.pop()) {
+                    active--;
+                    int res = completion->result;
+                    if (res == -ETIME && completion->op == Completion::Op::Timeout) {
+                        res = 0;
+                    }
+                    if (res >= 0) {
+                        completion->callback(*this, *completion, usize(static_cast<std::size_t>(res)));
+                    } else {
+                        completion->callback(*this, *completion, loop_impl::errorFromErrno(-res));
+                    }
+                }
+            }
+
+            // io_uring backend
+
+            bool queueSqe(Completion& completion) {
+                unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+                if (ring.sq_local_tail - head >= ring.sq_entries) {
+                    return false;
+                }
+                io_uring_sqe* sqe = &ring.sqes[ring.sq_local_tail & ring.sq_mask];
+                std::memset(sqe, 0, sizeof(*sqe));
+                sqe->fd = completion.fd;
+                sqe->user_data = reinterpret_cast<std::uint64_t>(&completion);
+                switch (completion.op) {
+                    case Completion::Op::Read:
+                    case Completion::Op::Write:
+                    case Completion::Op::ReadFixed:
+                    case Completion::Op::WriteFixed:
+                        sqe->opcode = completion.op == Completion::Op::Read ? IORING_OP_READ
+                            : completion.op == Completion::Op::Write ? IORING_OP_WRITE
+                            : completion.op == Completion::Op::ReadFixed ? IORING_OP_READ_FIXED
+                            : IORING_OP_WRITE_FIXED;
+                        sqe->addr = reinterpret_cast<std::uint64_t>(completion.buffer);
+                        sqe->len = static_cast<std::uint32_t>(completion.len);
+                        sqe->off = completion.offset;
+                        sqe->buf_index = completion.buffer_index;
+                        break;
+                    case Completion::Op::Accept:
+                        sqe->opcode = IORING_OP_ACCEPT;
+                        sqe->accept_flags = SOCK_CLOEXEC;
+                        break;
+                    case Completion::Op::Timeout:
+                        sqe->opcode = IORING_OP_TIMEOUT;
+                        sqe->fd = -1;
+                        sqe->addr = reinterpret_cast<std::uint64_t>(&completion.timeout);
+                        sqe->len = 1;
+                        break;
+                }
+                ring.sq_local_tail++;
+                ring.to_submit++;
+                return true;
+            }
+
+            Error<IoError> uringEnter(unsigned min_complete) {
+                if (ring.to_submit == 0 && min_complete == 0) {
+                    return {};
+                }
+                __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+                unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+                while (true) {
+                    int submitted = loop_impl::uringEnter(fd, ring.to_submit, min_complete, flags);
+                    if (submitted >= 0) {
+                        ring.to_submit -= static_cast<unsigned>(submitted);
+                        return {};
+                    }
+                    switch (errno) {
+                        case EINTR: continue;
+                        // The completion queue is full, reaping makes room.
+                        case EAGAIN:
+                        case EBUSY: return {};
+                        default: return loop_impl::errorFromErrno(errno);
+                    }
+                }
+            }
+
+            void uringReap() {
+                unsigned head = *ring.cq_head;
+                unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+                for (; head != tail; head++) {
+                    const io_uring_cqe& cqe = ring.cqes[head & ring.cq_mask];
+                    Completion* completion = reinterpret_cast<Completion*>(cqe.user_data);
+                    completion->result = cqe.res;
+                    completed.push(completion);
+                }
+                __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+            }
+
+            void uringQueueUnqueued() {
+                while (!unqueued.isEmpty() && queueSqe(*unqueued.head)) {
+                    unqueued.pop();
+                }
+            }
+
+            Error<IoError> uringStep(bool wait) {
+                uringQueueUnqueued();
+                unsigned min_complete = wait && completed.isEmpty() && active > 0 ? 1 : 0;
+                Error<IoError> error = uringEnter(min_complete);
+                if (error.hasError()) return error;
+                uringReap();
+                // Submission freed SQEs for operations that did not fit.
+                if (!unqueued.isEmpty()) {
+                    uringQueueUnqueued();
+                    error = uringEnter(0);
+                    if (error.hasError()) return error;
+                }
+                return {};
+            }
+
+            // epoll backend
+
+            void epollPerform(Completion& completion) {
+                while (true) {
+                    ssize_t count = 0;
+                    switch (completion.op) {
+                        case Completion::Op::Read:
+                        case Completion::Op::ReadFixed:
+                            count = completion.offset == stream_offset
+                                ? ::read(completion.fd, completion.buffer, completion.len)
+                                : ::pread(completion.fd, completion.buffer, completion.len, static_cast<off_t>(completion.offset));
+                            break;
+                        case Completion::Op::Write:
+                        case Completion::Op::WriteFixed:
+                            count = completion.offset == stream_offset
+                                ? ::write(completion.fd, completion.buffer, completion.len)
+                                : ::pwrite(completion.fd, completion.buffer, completion.len, static_cast<off_t>(completion.offset));
+                            break;
+                        case Completion::Op::Accept:
+                            count = ::accept4(completion.fd, nullptr, nullptr, SOCK_CLOEXEC);
+                            break;
+                        case Completion::Op::Timeout:
+                            break;
+                    }
+                    if (count < 0 && errno == EINTR) continue;
+                    completion.result = count >= 0 ? static_cast<int>(count) : -errno;
+                    return;
+                }
+            }
+
+            // Arms a one-shot, level-triggered watch on `file` for everything
+            // its waiting operations need, plus `extra`. Returns an errno.
+            int epollArm(int file, std::uint32_t extra) {
+                std::uint32_t events = extra;
+                for (Completion* it = waiting.head; it != nullptr; it = it->next) {
+                    if (it->fd == file) events |= loop_impl::epollEventsFor(*it);
+                }
+                if (events == 0) {
+                    return 0;
+                }
+                epoll_event event{};
+                event.events = events | EPOLLONESHOT;
+                event.data.fd = file;
+                if (::epoll_ctl(fd, EPOLL_CTL_MOD, file, &event) == 0) {
+                    return 0;
+                }
+                if (errno == ENOENT && ::epoll_ctl(fd, EPOLL_CTL_ADD, file, &event) == 0) {
+                    return 0;
+                }
+                return errno;
+            }
+
+            void epollStart(Completion& completion) {
+                if (completion.op == Completion::Op::Timeout) {
+                    completion.deadline_ns += loop_impl::monotonicNs();
+                    waiting.push(&completion);
+                    return;
+                }
+                int err = epollArm(completion.fd, loop_impl::epollEventsFor(completion));
+                if (err == EPERM) {
+                    // Regular files cannot be polled and never block.
+                    epollPerform(completion);
+                    completed.push(&completion);
+                } else if (err != 0) {
+                    completion.result = -err;
+                    completed.push(&completion);
+                } else {
+                    waiting.push(&completion);
+                }
+            }
+
+            // One readiness event only promises that a single read and a single
+            // write will not block, e.g. the first of two reads on a blocking
+            // pipe may drain it. The other operations stay armed.
+            void epollReady(int file, std::uint32_t events) {
+                loop_impl::CompletionList still{};
+                bool rearm = false;
+                std::uint32_t performed = 0;
+                while (Completion* completion = waiting.pop()) {
+                    std::uint32_t wanted = loop_impl::epollEventsFor(*completion);
+                    bool matches = completion->fd == file
+                        && (performed & wanted) == 0
+                        && (events & (wanted | EPOLLERR | EPOLLHUP)) != 0;
+                    if (matches) {
+                        performed |= wanted;
+                        epollPerform(*completion);
+                        if (completion->result != -EAGAIN) {
+                            completed.push(completion);
+                            continue;
+                        }
+                    }
+                    rearm |= completion->fd == file;
+                    still.push(completion);
+                }
+                waiting = still;
+                if (rearm) {
+                    (void) epollArm(file, 0);
+                }
+            }
+
+            void epollExpireTimers() {
+                std::int64_t now = loop_impl::monotonicNs();
+                loop_impl::CompletionList still{};
+                while (Completion* completion = waiting.pop()) {
+                    if (completion->op == Completion::Op::Timeout && completion->deadline_ns <= now) {
+                        completion->result = 0;
+                        completed.push(completion);
+                    } else {
+                        still.push(completion);
+                    }
+                }
+                waiting = still;
+            }
+
+            Error<IoError> epollStep(bool wait) {
+                while (Completion* completion = unqueued.pop()) {
+                    epollStart(*completion);
+                }
+                if (waiting.isEmpty()) {
+                    return {};
+                }
+
+                int timeout_ms = 0;
+                if (wait && completed.isEmpty()) {
+                    timeout_ms = -1;
+                    std::int64_t now = loop_impl::monotonicNs();
+                    for (Completion* it = waiting.head; it != nullptr; it = it->next) {
+                        if (it->op != Completion::Op::Timeout) continue;
+                        std::int64_t remaining = it->deadline_ns > now ? (it->deadline_ns - now + 999999) / 1000000 : 0;
+                        if (timeout_ms < 0 || remaining < timeout_ms) {
+                            timeout_ms = static_cast<int>(std::min<std::int64_t>(remaining, std::numeric_limits<int>::max()));
+                        }
+                    }
+                }
+
+                epoll_event events[64];
+                int count = ::epoll_wait(fd, events, 64, timeout_ms);
+                if (count < 0) {
+                    if (errno != EINTR) return loop_impl::errorFromErrno(errno);
+                    count = 0;
+                }
+                for (int i = 0; i < count; i++) {
+                    epollReady(events[i].data.fd, events[i].events);
+                }
+                epollExpireTimers();
+                return {};
+            }
+        };
+    }
+}
+#endif
+// ==== event loop
+
+// coroutines ====
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+namespace stj {
+    namespace async {
+        namespace async_impl {
+            template <typename E, typename... Enums>
+            constexpr bool contains_v = (std::is_same_v<E, Enums> || ...);
+
+            template <typename Arg>
+            bool pickAllocator(heap::Allocator& found, const Arg& arg) {
+                if constexpr (std::is_same_v<Arg, heap::Allocator>) {
+                    found = arg;
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+
+            // The first heap::Allocator among the coroutine's parameters,
+            // or c_allocator when there is none.
+            template <typename... Args>
+            heap::Allocator findAllocator(const Args&... args) {
+                heap::Allocator found = heap::c_allocator;
+                (void) (pickAllocator(found, args) || ...);
+                return found;
+            }
+
+            constexpr std::size_t frameAllocatorOffset(std::size_t size) {
+                return (size + alignof(heap::Allocator) - 1) & ~(alignof(heap::Allocator) - 1);
+            }
+
+            // The allocator is stored behind the frame, operator delete only
+            // gets the pointer and the size.
+            inline void* allocateFrame(heap::Allocator allocator, std::size_t size) {
+                std::size_t offset = frameAllocatorOffset(size);
+                Slice<u8> bytes = allocator.alloc<u8>(offset + sizeof(heap::Allocator));
+                unsigned char* raw = reinterpret_cast<unsigned char*>(bytes.ptr.raw_ptr);
+                std::memcpy(raw + offset, &allocator, sizeof(heap::Allocator));
+                return raw;
+            }
+
+            inline void freeFrame(void* frame, std::size_t size) {
+                std::size_t offset = frameAllocatorOffset(size);
+                heap::Allocator allocator;
+                unsigned char* raw = static_cast<unsigned char*>(frame);
+                std::memcpy(&allocator, raw + offset, sizeof(heap::Allocator));
+                allocator.free(Slice<u8>{MiPtr<u8>(static_cast<u8*>(frame)), offset + sizeof(heap::Allocator)});
+            }
+
+            struct PromiseBase {
+                // Resumed when the task finishes, the awaiting coroutine or
+                // nothing for a task started by a Scheduler.
+                std::coroutine_handle<> continuation = std::noop_coroutine();
+                bool finished = false;
+
+                std::suspend_always initial_suspend() noexcept {
+                    return {};
+                }
+
+                struct FinalAwaiter {
+                    bool await_ready() noexcept {
+                        return false;
+                    }
+
+                    template <typename P>
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+                        return handle.promise().continuation;
+                    }
+
+                    void await_resume() noexcept {}
+                };
+
+                FinalAwaiter final_suspend() noexcept {
+                    return {};
+                }
+
+                void unhandled_exception() {
+                    PANIC("Unhandled exception in coroutine");
+                }
+            };
+
+            // Suspends for good on an error: the error becomes the task's
+            // result and control goes to the continuation, the frame stays
+            // until its Task is destroyed.
+            template <typename U, typename... Enums>
+            struct TryAwaiter {
+                Result<U, Enums...> result;
+                const debug::ErrorReturnSite* site;
+
+                bool await_ready() const noexcept {
+                    return result.hasValue();
+                }
+
+                template <typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+                    #ifdef STJ_ERROR_RETURN_TRACE
+                        __stj_basic_impl::pushErrorReturn(site, handle.address());
+                    #endif
+                    handle.promise().fail(result);
+                    return handle.promise().continuation;
+                }
+
+                U await_resume() {
+                    return std::move(result.value());
+                }
+            };
+
+            template <typename U, typename... Enums>
+            TryAwaiter<U, Enums...> tryAwait(Result<U, Enums...> result, const debug::ErrorReturnSite* site) {
+                return {std::move(result), site};
+            }
+
+            // Same for an Error, there is no value to resume with.
+            template <typename... Enums>
+            struct TryErrorAwaiter {
+                Error<Enums...> error;
+                const debug::ErrorReturnSite* site;
+
+                bool await_ready() const noexcept {
+                    return error.isEmpty();
+                }
+
+                template <typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept {
+                    #ifdef STJ_ERROR_RETURN_TRACE
+                        __stj_basic_impl::pushErrorReturn(site, handle.address());
+                    #endif
+                    handle.promise().fail(error);
+                    return handle.promise().continuation;
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            template <typename... Enums>
+            TryErrorAwaiter<Enums...> tryAwait(Error<Enums...> error, const debug::ErrorReturnSite* site) {
+                return {error, site};
+            }
+        }
+
+        // Lazily started coroutine whose outcome is a Result<T, Enums...>.
+        // `co_return` takes anything that Result accepts, a value or one of
+        // the error enums. `co_await task` starts it and resumes the caller
+        // with its Result once it finishes. The frame is allocated through
+        // the first heap::Allocator parameter of the coroutine, so frames
+        // can come from an arena, and freed when the Task is destroyed.
+        // A task must be awaited or spawned at most once.
+        template <typename T, typename... Enums>
+        struct [[nodiscard]] Task {
+            // Shared by the promises of all coroutines returning this Task.
+            struct promise_type : async_impl::PromiseBase {
+                Result<T, Enums...> result;
+
+                template <typename U>
+                void return_value(U&& value) {
+                    result = Result<T, Enums...>(std::forward<U>(value));
+                    finished = true;
+                }
+
+                template <typename U, typename... OtherEnums>
+                void fail(const Result<U, OtherEnums...>& other) {
+                    static_assert(
+                        (async_impl::contains_v<OtherEnums, Enums...> && ...),
+                        "Task result must include all enum types from the tried Result"
+                    );
+                    ((other.template hasError<OtherEnums>()
+                        ? (void) (result = Result<T, Enums...>(other.template error<OtherEnums>()))
+                        : (void) 0), ...);
+                    finished = true;
+                }
+
+                template <typename... OtherEnums>
+                void fail(const Error<OtherEnums...>& other) {
+                    static_assert(
+                        (async_impl::contains_v<OtherEnums, Enums...> && ...),
+                        "Task result must include all enum types from the tried Error"
+                    );
+                    result = Result<T, Enums...>(other);
+                    finished = true;
+                }
+            };
+
+            // The promise of a coroutine with parameter types `Args`, picked
+            // through std::coroutine_traits below. Its operator new takes the
+            // parameters without being a function template: g++ 12 reports
+            // -Wmismatched-new-delete in every coroutine whose operator new is
+            // a template instance.
+            template <typename... Args>
+            struct Promise : promise_type {
+                static void* operator new(std::size_t size, const Args&... args) {
+                    return async_impl::allocateFrame(async_impl::findAllocator(args...), size);
+                }
+
+                static void operator delete(void* frame, std::size_t size) {
+                    async_impl::freeFrame(frame, size);
+                }
+
+                Task get_return_object() {
+                    return Task(std::coroutine_handle<Promise>::from_promise(*this), this);
+                }
+            };
+
+            std::coroutine_handle<> handle;
+            promise_type* promise;
+
+            Task(std::coroutine_handle<> handle, promise_type* promise) : handle(handle), promise(promise) {}
+
+            Task(Task&& other) noexcept
+                : handle(std::exchange(other.handle, nullptr)), promise(std::exchange(other.promise, nullptr)) {}
+
+            Task& operator=(Task&& other) noexcept {
+                if (this != &other) {
+                    if (handle) handle.destroy();
+                    handle = std::exchange(other.handle, nullptr);
+                    promise = std::exchange(other.promise, nullptr);
+                }
+                return *this;
+            }
+
+            Task(const Task&) = delete;
+            Task& operator=(const Task&) = delete;
+
+            ~Task() {
+                if (handle) handle.destroy();
+            }
+
+            bool isDone() const {
+                return promise->finished;
+            }
+
+            const Result<T, Enums...>& result() const {
+                if (!isDone()) [[unlikely]] {
+                    PANIC("Task result read before the task finished");
+                }
+                return promise->result;
+            }
+
+            struct Awaiter {
+                std::coroutine_handle<> handle;
+                promise_type* promise;
+
+                bool await_ready() const noexcept {
+                    return promise->finished;
+                }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                    promise->continuation = caller;
+                    return handle;
+                }
+
+                Result<T, Enums...> await_resume() {
+                    return std::move(promise->result);
+                }
+            };
+
+            Awaiter operator co_await() const noexcept {
+                return Awaiter{handle, promise};
+            }
+        };
+
+        // Single-threaded FIFO of coroutines ready to resume. Tasks stay owned
+        // by the caller, the scheduler only holds their handles.
+        struct Scheduler {
+            heap::Allocator allocator;
+            ArrayList<std::coroutine_handle<>> ready;
+            std::size_t head;
+
+            static Scheduler init(heap::Allocator allocator) {
+                return {allocator, ArrayList<std::coroutine_handle<>>::init(), 0};
+            }
+
+            void deinit() {
+                ready.deinit(allocator);
+            }
+
+            template <typename T, typename... Enums>
+            void spawn(Task<T, Enums...>& task) {
+                ready.append(allocator, task.handle);
+            }
+
+            struct YieldAwaiter {
+                Scheduler* scheduler;
+
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                void await_suspend(std::coroutine_handle<> handle) {
+                    scheduler->ready.append(scheduler->allocator, handle);
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            // `co_await scheduler.yield()` lets the other ready coroutines run
+            // first.
+            YieldAwaiter yield() {
+                return YieldAwaiter{this};
+            }
+
+            // Resumes ready coroutines until none are left.
+            void run() {
+                while (head < ready.items.len.raw()) {
+                    std::coroutine_handle<> handle = ready.items.ptr.raw_ptr[head++];
+                    handle.resume();
+                    // Reclaim the consumed prefix once it is most of the list.
+                    if (head >= 1024 && head * 2 >= ready.items.len.raw()) {
+                        std::size_t remaining = ready.items.len.raw() - head;
+                        std::memmove(ready.items.ptr.raw_ptr, ready.items.ptr.raw_ptr + head, remaining * sizeof(std::coroutine_handle<>));
+                        ready.items = ready.items.ptr.slice(0, remaining);
+                        head = 0;
+                    }
+                }
+                ready.items = ready.items.ptr.slice(0, 0);
+                head = 0;
+            }
+
+            // Spawns `task`, runs until nothing is ready and returns its result,
+            // which must be available by then.
+            template <typename T, typename... Enums>
+            const Result<T, Enums...>& blockOn(Task<T, Enums...>& task) {
+                spawn(task);
+                run();
+                return task.result();
+            }
+        };
+    }
+}
+
+template <typename T, typename... Enums, typename... Args>
+struct std::coroutine_traits<stj::async::Task<T, Enums...>, Args...> {
+    using promise_type = typename stj::async::Task<T, Enums...>::template Promise<Args...>;
+};
+
+#ifdef STJ_ERROR_RETURN_TRACE
+#define STJ_CO_TRY_SITE() ([_stj_function = __func__]() { \
+    static const ::stj::debug::ErrorReturnSite _stj_error_return_site{__FILE__, __LINE__, _stj_function}; \
+    return &_stj_error_return_site; \
+}())
+#else
+#define STJ_CO_TRY_SITE() nullptr
+#endif
+
+// TRY for coroutines returning Task: yields the value of a Result, or
+// finishes the task with its error. Statement expressions cannot hold
+// co_await or co_return, so this is an awaiter instead.
+#define CO_TRY(expr) (co_await ::stj::async::async_impl::tryAwait((expr), STJ_CO_TRY_SITE()))
+#endif
+// ==== coroutines